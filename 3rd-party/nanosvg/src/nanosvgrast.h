@@ -51,6 +51,22 @@ typedef struct NSVGrasterizer NSVGrasterizer;
 // Allocated rasterizer context.
 NSVGrasterizer* nsvgCreateRasterizer(void);
 
+// Selects the scanline blending and gradient kernels: 0 uses the scalar
+// ones, non-zero the fastest (SSE2/AVX2) ones the CPU supports, which
+// is the default. Both produce identical output.
+#define NSVG_HAVE_RASTERIZER_SIMD 1
+void nsvgRasterizerUseSIMD(NSVGrasterizer* r, int enable);
+
+// Forces one set of kernels, for testing them against each other.
+// Returns 0, leaving the kernels unchanged, if the build or the CPU
+// does not support the set.
+enum NSVGkernels {
+	NSVG_KERNELS_SCALAR,
+	NSVG_KERNELS_SSE2,
+	NSVG_KERNELS_AVX2,
+};
+int nsvgRasterizerUseKernels(NSVGrasterizer* r, enum NSVGkernels kernels);
+
 // Rasterizes SVG image, returns RGBA image (non-premultiplied alpha)
 //   r - pointer to rasterizer context
 //   image - pointer to image to rasterize
@@ -64,6 +80,39 @@ void nsvgRasterize(NSVGrasterizer* r,
 				   NSVGimage* image, float tx, float ty, float scale,
 				   unsigned char* dst, int w, int h, int stride);
 
+// Rasterizes SVG image, returns BGRA image (premultiplied alpha), i.e.
+// native ARGB32 pixels on little endian hosts. Same arguments as
+// nsvgRasterize().
+#define NSVG_HAVE_RASTERIZE_PREMULTIPLIED_BGRA 1
+void nsvgRasterizePremultipliedBGRA(NSVGrasterizer* r,
+				   NSVGimage* image, float tx, float ty, float scale,
+				   unsigned char* dst, int w, int h, int stride);
+
+// Flattened and sorted edges, and paints, of all shapes of an image,
+// for rasterizing it in horizontal bands, possibly concurrently.
+typedef struct NSVGprepared NSVGprepared;
+
+// Flattens the image for rasterizing at the given offset and scale.
+// Shapes entirely outside of the w x h destination are skipped.
+//   r - rasterizer context, only used during the call
+//   premultipliedBGRA - produce BGRA instead of RGBA
+// Returns NULL on error.
+#define NSVG_HAVE_RASTERIZE_PREPARED 2
+NSVGprepared* nsvgPrepare(NSVGrasterizer* r,
+				   NSVGimage* image, float tx, float ty, float scale,
+				   int w, int h, int premultipliedBGRA);
+
+// Rasterizes rows [y0, y1) of a prepared image, with premultiplied
+// alpha. The prepared image is only read, so bands can be rasterized
+// concurrently, provided each thread uses its own rasterizer context.
+//   dst - pointer to the first row (row 0) of the destination image
+//   w, h, stride - as for nsvgRasterize()
+void nsvgRasterizePrepared(NSVGrasterizer* r, const NSVGprepared* prepared,
+				   unsigned char* dst, int w, int h, int stride,
+				   int y0, int y1);
+
+void nsvgDeletePrepared(NSVGprepared* prepared);
+
 // Deletes rasterizer context.
 void nsvgDeleteRasterizer(NSVGrasterizer*);
 
@@ -80,11 +129,24 @@ void nsvgDeleteRasterizer(NSVGrasterizer*);
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(NSVG_NO_SIMD)
+#include <immintrin.h>
+#define NSVG__X86_SIMD 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define NSVG__SUBSAMPLES	5
 #define NSVG__FIXSHIFT		10
 #define NSVG__FIX			(1 << NSVG__FIXSHIFT)
 #define NSVG__FIXMASK		(NSVG__FIX-1)
-#define NSVG__MEMPAGE_SIZE	1024
+#define NSVG__SPAN_CHUNK	64
+
+// Blends pixels of non-premultiplied RGBA colors, with coverage, over premultiplied dst
+typedef void (*NSVGblendFunc)(unsigned char* dst, const unsigned char* cover, const unsigned int* colors, int count);
+// Looks up gradient colors for consecutive pixels; returns fx of the next pixel
+typedef float (*NSVGgradientFunc)(unsigned int* colors, int count, float fx, float fy, float dx,
+								  const float* t, const unsigned int* lut);
 
 typedef struct NSVGedge {
 	float x0,y0, x1,y1;
@@ -104,15 +166,8 @@ typedef struct NSVGactiveEdge {
 	int x,dx;
 	float ey;
 	int dir;
-	struct NSVGactiveEdge *next;
 } NSVGactiveEdge;
 
-typedef struct NSVGmemPage {
-	unsigned char mem[NSVG__MEMPAGE_SIZE];
-	int size;
-	struct NSVGmemPage* next;
-} NSVGmemPage;
-
 typedef struct NSVGcachedPaint {
 	signed char type;
 	char spread;
@@ -120,6 +175,26 @@ typedef struct NSVGcachedPaint {
 	unsigned int colors[256];
 } NSVGcachedPaint;
 
+typedef struct NSVGpreparedShape {
+	int firstEdge;
+	int nedges;
+	int miny, maxy;			// Rows [miny, maxy) the edges may cover
+	char fillRule;
+	NSVGcachedPaint paint;
+} NSVGpreparedShape;
+
+struct NSVGprepared {
+	float tx, ty, scale;
+
+	NSVGedge* edges;
+	int nedges;
+	int cedges;
+
+	NSVGpreparedShape* shapes;
+	int nshapes;
+	int cshapes;
+};
+
 struct NSVGrasterizer
 {
 	float px, py;
@@ -139,15 +214,21 @@ struct NSVGrasterizer
 	int npoints2;
 	int cpoints2;
 
-	NSVGactiveEdge* freelist;
-	NSVGmemPage* pages;
-	NSVGmemPage* curpage;
+	NSVGedge* sorted;			// Scratch space for sorting edges
+	int csorted;
+
+	NSVGactiveEdge* active;		// Active edges, sorted on x
+	int cactive;
 
 	unsigned char* scanline;
 	int cscanline;
 
 	unsigned char* bitmap;
 	int width, height, stride;
+
+	NSVGblendFunc blend;
+	NSVGgradientFunc linearColors;
+	NSVGgradientFunc radialColors;
 };
 
 NSVGrasterizer* nsvgCreateRasterizer(void)
@@ -159,6 +240,8 @@ NSVGrasterizer* nsvgCreateRasterizer(void)
 	r->tessTol = 0.25f;
 	r->distTol = 0.01f;
 
+	nsvgRasterizerUseSIMD(r, 1);
+
 	return r;
 
 error:
@@ -168,18 +251,11 @@ error:
 
 void nsvgDeleteRasterizer(NSVGrasterizer* r)
 {
-	NSVGmemPage* p;
-
 	if (r == NULL) return;
 
-	p = r->pages;
-	while (p != NULL) {
-		NSVGmemPage* next = p->next;
-		free(p);
-		p = next;
-	}
-
 	if (r->edges) free(r->edges);
+	if (r->sorted) free(r->sorted);
+	if (r->active) free(r->active);
 	if (r->points) free(r->points);
 	if (r->points2) free(r->points2);
 	if (r->scanline) free(r->scanline);
@@ -187,51 +263,6 @@ void nsvgDeleteRasterizer(NSVGrasterizer* r)
 	free(r);
 }
 
-static NSVGmemPage* nsvg__nextPage(NSVGrasterizer* r, NSVGmemPage* cur)
-{
-	NSVGmemPage *newp;
-
-	// If using existing chain, return the next page in chain
-	if (cur != NULL && cur->next != NULL) {
-		return cur->next;
-	}
-
-	// Alloc new page
-	newp = (NSVGmemPage*)malloc(sizeof(NSVGmemPage));
-	if (newp == NULL) return NULL;
-	memset(newp, 0, sizeof(NSVGmemPage));
-
-	// Add to linked list
-	if (cur != NULL)
-		cur->next = newp;
-	else
-		r->pages = newp;
-
-	return newp;
-}
-
-static void nsvg__resetPool(NSVGrasterizer* r)
-{
-	NSVGmemPage* p = r->pages;
-	while (p != NULL) {
-		p->size = 0;
-		p = p->next;
-	}
-	r->curpage = r->pages;
-}
-
-static unsigned char* nsvg__alloc(NSVGrasterizer* r, int size)
-{
-	unsigned char* buf;
-	if (size > NSVG__MEMPAGE_SIZE) return NULL;
-	if (r->curpage == NULL || r->curpage->size+size > NSVG__MEMPAGE_SIZE) {
-		r->curpage = nsvg__nextPage(r, r->curpage);
-	}
-	buf = &r->curpage->mem[r->curpage->size];
-	r->curpage->size += size;
-	return buf;
-}
-
 static int nsvg__ptEquals(float x1, float y1, float x2, float y2, float tol)
 {
 	float dx = x2 - x1;
@@ -844,6 +875,14 @@ static void nsvg__flattenShapeStroke(NSVGrasterizer* r, NSVGshape* shape, float
 	}
 }
 
+// Maps a float to an unsigned key with the same ordering
+static unsigned int nsvg__sortKey(float f)
+{
+	unsigned int u;
+	memcpy(&u, &f, sizeof(u));
+	return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
 static int nsvg__cmpEdge(const void *p, const void *q)
 {
 	const NSVGedge* a = (const NSVGedge*)p;
@@ -854,21 +893,82 @@ static int nsvg__cmpEdge(const void *p, const void *q)
 	return 0;
 }
 
-
-static NSVGactiveEdge* nsvg__addActive(NSVGrasterizer* r, NSVGedge* e, float startPoint)
+// Stable LSD radix sort of the edges on y0, 11 bits at a time. Passes
+// where all keys share the same digit are skipped. Falls back to qsort
+// if the scratch buffer cannot be allocated; the rasterizer relies on
+// the edges being sorted.
+static void nsvg__sortEdges(NSVGrasterizer* r)
 {
-	 NSVGactiveEdge* z;
+	NSVGedge *src = r->edges, *dst, *tmp;
+	unsigned int counts[3][2048];
+	int n = r->nedges, i, pass;
+
+	if (n < 2) return;
+
+	if (n < 32) {
+		// Insertion sort
+		for (i = 1; i < n; i++) {
+			NSVGedge e = src[i];
+			int j = i;
+			while (j > 0 && src[j-1].y0 > e.y0) {
+				src[j] = src[j-1];
+				j--;
+			}
+			src[j] = e;
+		}
+		return;
+	}
 
-	if (r->freelist != NULL) {
-		// Restore from freelist.
-		z = r->freelist;
-		r->freelist = z->next;
-	} else {
-		// Alloc new edge.
-		z = (NSVGactiveEdge*)nsvg__alloc(r, sizeof(NSVGactiveEdge));
-		if (z == NULL) return NULL;
+	if (r->cedges > r->csorted) {
+		tmp = (NSVGedge*)realloc(r->sorted, sizeof(NSVGedge) * r->cedges);
+		if (tmp == NULL) {
+			qsort(r->edges, n, sizeof(NSVGedge), nsvg__cmpEdge);
+			return;
+		}
+		r->sorted = tmp;
+		r->csorted = r->cedges;
+	}
+	dst = r->sorted;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < n; i++) {
+		unsigned int k = nsvg__sortKey(src[i].y0);
+		counts[0][k & 0x7ff]++;
+		counts[1][(k >> 11) & 0x7ff]++;
+		counts[2][k >> 22]++;
+	}
+
+	for (pass = 0; pass < 3; pass++) {
+		unsigned int* c = counts[pass];
+		unsigned int sum = 0, t;
+		int shift = pass * 11;
+		unsigned int first = (nsvg__sortKey(src[0].y0) >> shift) & 0x7ff;
+
+		if (c[first] == (unsigned int)n) continue;
+
+		for (i = 0; i < 2048; i++) {
+			t = c[i];
+			c[i] = sum;
+			sum += t;
+		}
+		for (i = 0; i < n; i++) {
+			unsigned int d = (nsvg__sortKey(src[i].y0) >> shift) & 0x7ff;
+			dst[c[d]++] = src[i];
+		}
+
+		tmp = src; src = dst; dst = tmp;
+	}
+
+	// The result may have ended up in the scratch buffer; swap them
+	if (src != r->edges) {
+		r->sorted = r->edges;
+		r->edges = src;
+		i = r->cedges; r->cedges = r->csorted; r->csorted = i;
 	}
+}
 
+static void nsvg__initActive(NSVGactiveEdge* z, const NSVGedge* e, float startPoint)
+{
 	float dxdy = (e->x1 - e->x0) / (e->y1 - e->y0);
 //	STBTT_assert(e->y0 <= start_point);
 	// round dx down to avoid going too far
@@ -879,16 +979,17 @@ static NSVGactiveEdge* nsvg__addActive(NSVGrasterizer* r, NSVGedge* e, float sta
 	z->x = (int)nsvg__roundf(NSVG__FIX * (e->x0 + dxdy * (startPoint - e->y0)));
 //	z->x -= off_x * FIX;
 	z->ey = e->y1;
-	z->next = 0;
 	z->dir = e->dir;
-
-	return z;
 }
 
-static void nsvg__freeActive(NSVGrasterizer* r, NSVGactiveEdge* z)
+// First subsample scanline whose center is at or below y
+static int nsvg__firstSubsample(float y)
 {
-	z->next = r->freelist;
-	r->freelist = z;
+	int n = (int)ceilf(y - 0.5f);
+	if (n < 0) n = 0;
+	while ((float)n + 0.5f < y) n++;
+	while (n > 0 && (float)(n - 1) + 0.5f >= y) n--;
+	return n;
 }
 
 static void nsvg__fillScanline(unsigned char* scanline, int len, int x0, int x1, int maxWeight, int* xmin, int* xmax)
@@ -912,7 +1013,17 @@ static void nsvg__fillScanline(unsigned char* scanline, int len, int x0, int x1,
 			else
 				j = len; // clip
 
-			for (++i; i < j; ++i) // fill pixels between x0 and x1
+			++i;
+#ifdef __SSE2__
+			if (j - i >= 16) {
+				__m128i w = _mm_set1_epi8((char)maxWeight);
+				for (; i + 16 <= j; i += 16) {
+					__m128i* p = (__m128i*)&scanline[i];
+					_mm_storeu_si128(p, _mm_add_epi8(_mm_loadu_si128(p), w));
+				}
+			}
+#endif
+			for (; i < j; ++i) // fill pixels between x0 and x1
 				scanline[i] = (unsigned char)(scanline[i] + maxWeight);
 		}
 	}
@@ -921,14 +1032,16 @@ static void nsvg__fillScanline(unsigned char* scanline, int len, int x0, int x1,
 // note: this routine clips fills that extend off the edges... ideally this
 // wouldn't happen, but it could happen if the truetype glyph bounding boxes
 // are wrong, or if the user supplies a too-small bitmap
-static void nsvg__fillActiveEdges(unsigned char* scanline, int len, NSVGactiveEdge* e, int maxWeight, int* xmin, int* xmax, char fillRule)
+static void nsvg__fillActiveEdges(unsigned char* scanline, int len, const NSVGactiveEdge* e, int nactive, int maxWeight, int* xmin, int* xmax, char fillRule)
 {
+	const NSVGactiveEdge* end = e + nactive;
+
 	// non-zero winding fill
 	int x0 = 0, w = 0;
 
 	if (fillRule == NSVG_FILLRULE_NONZERO) {
 		// Non-zero
-		while (e != NULL) {
+		while (e != end) {
 			if (w == 0) {
 				// if we're currently at zero, we need to record the edge start point
 				x0 = e->x; w += e->dir;
@@ -938,11 +1051,11 @@ static void nsvg__fillActiveEdges(unsigned char* scanline, int len, NSVGactiveEd
 				if (w == 0)
 					nsvg__fillScanline(scanline, len, x0, x1, maxWeight, xmin, xmax);
 			}
-			e = e->next;
+			e++;
 		}
 	} else if (fillRule == NSVG_FILLRULE_EVENODD) {
 		// Even-odd
-		while (e != NULL) {
+		while (e != end) {
 			if (w == 0) {
 				// if we're currently at zero, we need to record the edge start point
 				x0 = e->x; w = 1;
@@ -950,7 +1063,7 @@ static void nsvg__fillActiveEdges(unsigned char* scanline, int len, NSVGactiveEd
 				int x1 = e->x; w = 0;
 				nsvg__fillScanline(scanline, len, x0, x1, maxWeight, xmin, xmax);
 			}
-			e = e->next;
+			e++;
 		}
 	}
 }
@@ -987,217 +1100,453 @@ static inline int nsvg__div255(int x)
     return ((x+1) * 257) >> 16;
 }
 
-static void nsvg__scanlineSolid(unsigned char* dst, int count, unsigned char* cover, int x, int y,
+static void nsvg__blend(unsigned char* dst, const unsigned char* cover, const unsigned int* colors, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		int r,g,b,a,ia;
+		int cr = colors[i] & 0xff;
+		int cg = (colors[i] >> 8) & 0xff;
+		int cb = (colors[i] >> 16) & 0xff;
+		int ca = (colors[i] >> 24) & 0xff;
+
+		a = nsvg__div255((int)cover[i] * ca);
+		ia = 255 - a;
+
+		// Premultiply
+		r = nsvg__div255(cr * a);
+		g = nsvg__div255(cg * a);
+		b = nsvg__div255(cb * a);
+
+		// Blend over
+		r += nsvg__div255(ia * (int)dst[0]);
+		g += nsvg__div255(ia * (int)dst[1]);
+		b += nsvg__div255(ia * (int)dst[2]);
+		a += nsvg__div255(ia * (int)dst[3]);
+
+		dst[0] = (unsigned char)r;
+		dst[1] = (unsigned char)g;
+		dst[2] = (unsigned char)b;
+		dst[3] = (unsigned char)a;
+
+		dst += 4;
+	}
+}
+
+// TODO: spread modes.
+static float nsvg__linearColors(unsigned int* colors, int count, float fx, float fy, float dx,
+								const float* t, const unsigned int* lut)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		float gy = fx*t[1] + fy*t[3] + t[5];
+		colors[i] = lut[(int)nsvg__clampf(gy*255.0f, 0, 255.0f)];
+		fx += dx;
+	}
+	return fx;
+}
+
+// TODO: spread modes.
+// TODO: focus (fx,fy)
+static float nsvg__radialColors(unsigned int* colors, int count, float fx, float fy, float dx,
+								const float* t, const unsigned int* lut)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		float gx = fx*t[0] + fy*t[2] + t[4];
+		float gy = fx*t[1] + fy*t[3] + t[5];
+		float gd = sqrtf(gx*gx + gy*gy);
+		colors[i] = lut[(int)nsvg__clampf(gd*255.0f, 0, 255.0f)];
+		fx += dx;
+	}
+	return fx;
+}
+
+#ifdef NSVG__X86_SIMD
+
+// The kernels below mirror the scalar ones operation for operation, and
+// produce identical results: div255(x) == ((x+1)*257) >> 16 is a 16-bit
+// mulhi, and gradient positions are accumulated and evaluated in the
+// same order, in single precision.
+
+// One 16-bit half: two pixels of color, coverage (replicated to all
+// channels) and destination. Multiplying the alpha lane of the color
+// by 255 instead of the color's own alpha makes it come out as 'a'.
+__attribute__((target("sse2")))
+static inline __m128i nsvg__blendHalfSSE2(__m128i c, __m128i k, __m128i d)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i m257 = _mm_set1_epi16(257);
+	const __m128i k255 = _mm_set1_epi16(255);
+	const __m128i alphaLanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	__m128i ca, a, s, t;
+
+	ca = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+	a = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(k, ca), one), m257);
+	s = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_or_si128(c, alphaLanes), a), one), m257);
+	t = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(k255, a), d), one), m257);
+	return _mm_add_epi16(s, t);
+}
+
+__attribute__((target("sse2")))
+static void nsvg__blendSSE2(unsigned char* dst, const unsigned char* cover, const unsigned int* colors, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		int cov;
+		__m128i k, c, d, lo, hi;
+
+		memcpy(&cov, &cover[i], sizeof(cov));
+		if (cov == 0)
+			continue;  // Blending nothing leaves dst unchanged
+
+		k = _mm_cvtsi32_si128(cov);
+		k = _mm_unpacklo_epi8(k, k);
+		k = _mm_unpacklo_epi16(k, k);
+		c = _mm_loadu_si128((const __m128i*)&colors[i]);
+		d = _mm_loadu_si128((const __m128i*)&dst[i*4]);
+
+		lo = nsvg__blendHalfSSE2(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(k, zero), _mm_unpacklo_epi8(d, zero));
+		hi = nsvg__blendHalfSSE2(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(k, zero), _mm_unpackhi_epi8(d, zero));
+		_mm_storeu_si128((__m128i*)&dst[i*4], _mm_packus_epi16(lo, hi));
+	}
+
+	nsvg__blend(&dst[i*4], &cover[i], &colors[i], count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nsvg__blendHalfAVX2(__m256i c, __m256i k, __m256i d)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i m257 = _mm256_set1_epi16(257);
+	const __m256i k255 = _mm256_set1_epi16(255);
+	const __m256i alphaLanes = _mm256_set1_epi64x(0x00ff000000000000ll);
+	__m256i ca, a, s, t;
+
+	ca = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+	a = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(k, ca), one), m257);
+	s = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_or_si256(c, alphaLanes), a), one), m257);
+	t = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(k255, a), d), one), m257);
+	return _mm256_add_epi16(s, t);
+}
+
+__attribute__((target("avx2")))
+static void nsvg__blendAVX2(unsigned char* dst, const unsigned char* cover, const unsigned int* colors, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i replicate = _mm256_set1_epi32(0x01010101);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i cov = _mm_loadl_epi64((const __m128i*)&cover[i]);
+		__m256i k, c, d, lo, hi;
+
+		if (_mm_cvtsi128_si64(cov) == 0)
+			continue;  // Blending nothing leaves dst unchanged
+
+		k = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(cov), replicate);
+		c = _mm256_loadu_si256((const __m256i*)&colors[i]);
+		d = _mm256_loadu_si256((const __m256i*)&dst[i*4]);
+
+		lo = nsvg__blendHalfAVX2(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(k, zero), _mm256_unpacklo_epi8(d, zero));
+		hi = nsvg__blendHalfAVX2(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(k, zero), _mm256_unpackhi_epi8(d, zero));
+		_mm256_storeu_si256((__m256i*)&dst[i*4], _mm256_packus_epi16(lo, hi));
+	}
+
+	nsvg__blendSSE2(&dst[i*4], &cover[i], &colors[i], count - i);
+}
+
+// Clamps to [0,255] (as nsvg__clampf) and truncates to LUT indices
+__attribute__((target("sse2")))
+static inline __m128i nsvg__lutIndexSSE2(__m128 v)
+{
+	const __m128 k255 = _mm_set1_ps(255.0f);
+	v = _mm_mul_ps(v, k255);
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), k255);
+	return _mm_cvttps_epi32(v);
+}
+
+__attribute__((target("sse2")))
+static float nsvg__linearColorsSSE2(unsigned int* colors, int count, float fx, float fy, float dx,
+									const float* t, const unsigned int* lut)
+{
+	const __m128 t1 = _mm_set1_ps(t[1]);
+	const __m128 fyt3 = _mm_set1_ps(fy*t[3]);
+	const __m128 t5 = _mm_set1_ps(t[5]);
+	int idx[4];
+	int i = 0, j;
+
+	for (; i + 4 <= count; i += 4) {
+		float f0 = fx, f1 = f0 + dx, f2 = f1 + dx, f3 = f2 + dx;
+		__m128 vfx = _mm_set_ps(f3, f2, f1, f0);
+		__m128 gy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vfx, t1), fyt3), t5);
+
+		_mm_storeu_si128((__m128i*)idx, nsvg__lutIndexSSE2(gy));
+		for (j = 0; j < 4; j++)
+			colors[i+j] = lut[idx[j]];
+		fx = f3 + dx;
+	}
+
+	return nsvg__linearColors(&colors[i], count - i, fx, fy, dx, t, lut);
+}
+
+__attribute__((target("sse2")))
+static float nsvg__radialColorsSSE2(unsigned int* colors, int count, float fx, float fy, float dx,
+									const float* t, const unsigned int* lut)
+{
+	const __m128 t0 = _mm_set1_ps(t[0]);
+	const __m128 t1 = _mm_set1_ps(t[1]);
+	const __m128 fyt2 = _mm_set1_ps(fy*t[2]);
+	const __m128 fyt3 = _mm_set1_ps(fy*t[3]);
+	const __m128 t4 = _mm_set1_ps(t[4]);
+	const __m128 t5 = _mm_set1_ps(t[5]);
+	int idx[4];
+	int i = 0, j;
+
+	for (; i + 4 <= count; i += 4) {
+		float f0 = fx, f1 = f0 + dx, f2 = f1 + dx, f3 = f2 + dx;
+		__m128 vfx = _mm_set_ps(f3, f2, f1, f0);
+		__m128 gx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vfx, t0), fyt2), t4);
+		__m128 gy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vfx, t1), fyt3), t5);
+		__m128 gd = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)));
+
+		_mm_storeu_si128((__m128i*)idx, nsvg__lutIndexSSE2(gd));
+		for (j = 0; j < 4; j++)
+			colors[i+j] = lut[idx[j]];
+		fx = f3 + dx;
+	}
+
+	return nsvg__radialColors(&colors[i], count - i, fx, fy, dx, t, lut);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nsvg__lutIndexAVX2(__m256 v)
+{
+	const __m256 k255 = _mm256_set1_ps(255.0f);
+	v = _mm256_mul_ps(v, k255);
+	v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), k255);
+	return _mm256_cvttps_epi32(v);
+}
+
+// Positions of the next 8 pixels, accumulated one at a time like the scalar loop
+__attribute__((target("avx2")))
+static inline __m256 nsvg__positionsAVX2(float* fx, float dx)
+{
+	float f[8];
+	int j;
+	f[0] = *fx;
+	for (j = 1; j < 8; j++)
+		f[j] = f[j-1] + dx;
+	*fx = f[7] + dx;
+	return _mm256_loadu_ps(f);
+}
+
+__attribute__((target("avx2")))
+static float nsvg__linearColorsAVX2(unsigned int* colors, int count, float fx, float fy, float dx,
+									const float* t, const unsigned int* lut)
+{
+	const __m256 t1 = _mm256_set1_ps(t[1]);
+	const __m256 fyt3 = _mm256_set1_ps(fy*t[3]);
+	const __m256 t5 = _mm256_set1_ps(t[5]);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 vfx = nsvg__positionsAVX2(&fx, dx);
+		__m256 gy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vfx, t1), fyt3), t5);
+		__m256i idx = nsvg__lutIndexAVX2(gy);
+		_mm256_storeu_si256((__m256i*)&colors[i], _mm256_i32gather_epi32((const int*)lut, idx, 4));
+	}
+
+	return nsvg__linearColorsSSE2(&colors[i], count - i, fx, fy, dx, t, lut);
+}
+
+__attribute__((target("avx2")))
+static float nsvg__radialColorsAVX2(unsigned int* colors, int count, float fx, float fy, float dx,
+									const float* t, const unsigned int* lut)
+{
+	const __m256 t0 = _mm256_set1_ps(t[0]);
+	const __m256 t1 = _mm256_set1_ps(t[1]);
+	const __m256 fyt2 = _mm256_set1_ps(fy*t[2]);
+	const __m256 fyt3 = _mm256_set1_ps(fy*t[3]);
+	const __m256 t4 = _mm256_set1_ps(t[4]);
+	const __m256 t5 = _mm256_set1_ps(t[5]);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 vfx = nsvg__positionsAVX2(&fx, dx);
+		__m256 gx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vfx, t0), fyt2), t4);
+		__m256 gy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vfx, t1), fyt3), t5);
+		__m256 gd = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy)));
+		__m256i idx = nsvg__lutIndexAVX2(gd);
+		_mm256_storeu_si256((__m256i*)&colors[i], _mm256_i32gather_epi32((const int*)lut, idx, 4));
+	}
+
+	return nsvg__radialColorsSSE2(&colors[i], count - i, fx, fy, dx, t, lut);
+}
+
+#endif // NSVG__X86_SIMD
+
+int nsvgRasterizerUseKernels(NSVGrasterizer* r, enum NSVGkernels kernels)
+{
+	switch (kernels) {
+	case NSVG_KERNELS_SCALAR:
+		r->blend = nsvg__blend;
+		r->linearColors = nsvg__linearColors;
+		r->radialColors = nsvg__radialColors;
+		return 1;
+
+#ifdef NSVG__X86_SIMD
+	case NSVG_KERNELS_SSE2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse2"))
+			return 0;
+		r->blend = nsvg__blendSSE2;
+		r->linearColors = nsvg__linearColorsSSE2;
+		r->radialColors = nsvg__radialColorsSSE2;
+		return 1;
+
+	case NSVG_KERNELS_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			return 0;
+		r->blend = nsvg__blendAVX2;
+		r->linearColors = nsvg__linearColorsAVX2;
+		r->radialColors = nsvg__radialColorsAVX2;
+		return 1;
+#endif
+
+	default:
+		return 0;
+	}
+}
+
+void nsvgRasterizerUseSIMD(NSVGrasterizer* r, int enable)
+{
+	nsvgRasterizerUseKernels(r, NSVG_KERNELS_SCALAR);
+
+	if (enable &&
+		!nsvgRasterizerUseKernels(r, NSVG_KERNELS_AVX2))
+		nsvgRasterizerUseKernels(r, NSVG_KERNELS_SSE2);
+}
+
+static void nsvg__scanlineSolid(NSVGrasterizer* r, unsigned char* dst, int count, unsigned char* cover, int x, int y,
 								float tx, float ty, float scale, NSVGcachedPaint* cache)
 {
+	unsigned int colors[NSVG__SPAN_CHUNK];
+	int i, n;
 
 	if (cache->type == NSVG_PAINT_COLOR) {
-		int i, cr, cg, cb, ca;
-		cr = cache->colors[0] & 0xff;
-		cg = (cache->colors[0] >> 8) & 0xff;
-		cb = (cache->colors[0] >> 16) & 0xff;
-		ca = (cache->colors[0] >> 24) & 0xff;
-
-		for (i = 0; i < count; i++) {
-			int r,g,b;
-			int a = nsvg__div255((int)cover[0] * ca);
-			int ia = 255 - a;
-			// Premultiply
-			r = nsvg__div255(cr * a);
-			g = nsvg__div255(cg * a);
-			b = nsvg__div255(cb * a);
-
-			// Blend over
-			r += nsvg__div255(ia * (int)dst[0]);
-			g += nsvg__div255(ia * (int)dst[1]);
-			b += nsvg__div255(ia * (int)dst[2]);
-			a += nsvg__div255(ia * (int)dst[3]);
-
-			dst[0] = (unsigned char)r;
-			dst[1] = (unsigned char)g;
-			dst[2] = (unsigned char)b;
-			dst[3] = (unsigned char)a;
-
-			cover++;
-			dst += 4;
-		}
-	} else if (cache->type == NSVG_PAINT_LINEAR_GRADIENT) {
-		// TODO: spread modes.
-		// TODO: plenty of opportunities to optimize.
-		float fx, fy, dx, gy;
-		float* t = cache->xform;
-		int i, cr, cg, cb, ca;
-		unsigned int c;
-
-		fx = ((float)x - tx) / scale;
-		fy = ((float)y - ty) / scale;
-		dx = 1.0f / scale;
-
-		for (i = 0; i < count; i++) {
-			int r,g,b,a,ia;
-			gy = fx*t[1] + fy*t[3] + t[5];
-			c = cache->colors[(int)nsvg__clampf(gy*255.0f, 0, 255.0f)];
-			cr = (c) & 0xff;
-			cg = (c >> 8) & 0xff;
-			cb = (c >> 16) & 0xff;
-			ca = (c >> 24) & 0xff;
-
-			a = nsvg__div255((int)cover[0] * ca);
-			ia = 255 - a;
-
-			// Premultiply
-			r = nsvg__div255(cr * a);
-			g = nsvg__div255(cg * a);
-			b = nsvg__div255(cb * a);
-
-			// Blend over
-			r += nsvg__div255(ia * (int)dst[0]);
-			g += nsvg__div255(ia * (int)dst[1]);
-			b += nsvg__div255(ia * (int)dst[2]);
-			a += nsvg__div255(ia * (int)dst[3]);
-
-			dst[0] = (unsigned char)r;
-			dst[1] = (unsigned char)g;
-			dst[2] = (unsigned char)b;
-			dst[3] = (unsigned char)a;
-
-			cover++;
-			dst += 4;
-			fx += dx;
+		n = count < NSVG__SPAN_CHUNK ? count : NSVG__SPAN_CHUNK;
+		for (i = 0; i < n; i++)
+			colors[i] = cache->colors[0];
+
+		for (i = 0; i < count; i += n) {
+			n = count - i < NSVG__SPAN_CHUNK ? count - i : NSVG__SPAN_CHUNK;
+			r->blend(&dst[i*4], &cover[i], colors, n);
 		}
-	} else if (cache->type == NSVG_PAINT_RADIAL_GRADIENT) {
-		// TODO: spread modes.
-		// TODO: plenty of opportunities to optimize.
-		// TODO: focus (fx,fy)
-		float fx, fy, dx, gx, gy, gd;
-		float* t = cache->xform;
-		int i, cr, cg, cb, ca;
-		unsigned int c;
-
-		fx = ((float)x - tx) / scale;
-		fy = ((float)y - ty) / scale;
-		dx = 1.0f / scale;
-
-		for (i = 0; i < count; i++) {
-			int r,g,b,a,ia;
-			gx = fx*t[0] + fy*t[2] + t[4];
-			gy = fx*t[1] + fy*t[3] + t[5];
-			gd = sqrtf(gx*gx + gy*gy);
-			c = cache->colors[(int)nsvg__clampf(gd*255.0f, 0, 255.0f)];
-			cr = (c) & 0xff;
-			cg = (c >> 8) & 0xff;
-			cb = (c >> 16) & 0xff;
-			ca = (c >> 24) & 0xff;
-
-			a = nsvg__div255((int)cover[0] * ca);
-			ia = 255 - a;
-
-			// Premultiply
-			r = nsvg__div255(cr * a);
-			g = nsvg__div255(cg * a);
-			b = nsvg__div255(cb * a);
-
-			// Blend over
-			r += nsvg__div255(ia * (int)dst[0]);
-			g += nsvg__div255(ia * (int)dst[1]);
-			b += nsvg__div255(ia * (int)dst[2]);
-			a += nsvg__div255(ia * (int)dst[3]);
-
-			dst[0] = (unsigned char)r;
-			dst[1] = (unsigned char)g;
-			dst[2] = (unsigned char)b;
-			dst[3] = (unsigned char)a;
-
-			cover++;
-			dst += 4;
-			fx += dx;
+	} else if (cache->type == NSVG_PAINT_LINEAR_GRADIENT || cache->type == NSVG_PAINT_RADIAL_GRADIENT) {
+		NSVGgradientFunc gradientColors = cache->type == NSVG_PAINT_LINEAR_GRADIENT
+			? r->linearColors : r->radialColors;
+		float fx = ((float)x - tx) / scale;
+		float fy = ((float)y - ty) / scale;
+		float dx = 1.0f / scale;
+
+		for (i = 0; i < count; i += n) {
+			n = count - i < NSVG__SPAN_CHUNK ? count - i : NSVG__SPAN_CHUNK;
+			fx = gradientColors(colors, n, fx, fy, dx, cache->xform, cache->colors);
+			r->blend(&dst[i*4], &cover[i], colors, n);
 		}
 	}
 }
 
-static void nsvg__rasterizeSortedEdges(NSVGrasterizer *r, float tx, float ty, float scale, NSVGcachedPaint* cache, char fillRule)
+static void nsvg__rasterizeSortedEdges(NSVGrasterizer *r, NSVGedge* edges, int nedges, int y0, int y1,
+									   float tx, float ty, float scale, NSVGcachedPaint* cache, char fillRule)
 {
-	NSVGactiveEdge *active = NULL;
-	int y, s;
+	NSVGactiveEdge *active = r->active;
+	int nactive = 0;
+	int y, s, i, j;
 	int e = 0;
 	int maxWeight = (255 / NSVG__SUBSAMPLES);  // weight per vertical scanline
 	int xmin, xmax;
 
-	for (y = 0; y < r->height; y++) {
+	for (y = y0; y < y1; y++) {
 		memset(r->scanline, 0, r->width);
 		xmin = r->width;
 		xmax = 0;
 		for (s = 0; s < NSVG__SUBSAMPLES; ++s) {
 			// find center of pixel for this scanline
 			float scany = (float)(y*NSVG__SUBSAMPLES + s) + 0.5f;
-			NSVGactiveEdge **step = &active;
 
 			// update all active edges;
 			// remove all active edges that terminate before the center of this scanline
-			while (*step) {
-				NSVGactiveEdge *z = *step;
-				if (z->ey <= scany) {
-					*step = z->next; // delete from list
-//					NSVG__assert(z->valid);
-					nsvg__freeActive(r, z);
-				} else {
-					z->x += z->dx; // advance to position for current scanline
-					step = &((*step)->next); // advance through list
-				}
+			for (i = j = 0; i < nactive; i++) {
+				if (active[i].ey <= scany)
+					continue;
+				active[j] = active[i];
+				active[j].x += active[j].dx; // advance to position for current scanline
+				j++;
 			}
-
-			// resort the list if needed
-			for (;;) {
-				int changed = 0;
-				step = &active;
-				while (*step && (*step)->next) {
-					if ((*step)->x > (*step)->next->x) {
-						NSVGactiveEdge* t = *step;
-						NSVGactiveEdge* q = t->next;
-						t->next = q->next;
-						q->next = t;
-						*step = q;
-						changed = 1;
-					}
-					step = &(*step)->next;
-				}
-				if (!changed) break;
+			nactive = j;
+
+			// resort the array if needed (stable, it is nearly sorted)
+			for (i = 1; i < nactive; i++) {
+				NSVGactiveEdge z = active[i];
+				for (j = i; j > 0 && active[j-1].x > z.x; j--)
+					active[j] = active[j-1];
+				active[j] = z;
 			}
 
 			// insert all edges that start before the center of this scanline -- omit ones that also end on this scanline
-			while (e < r->nedges && r->edges[e].y0 <= scany) {
-				if (r->edges[e].y1 > scany) {
-					NSVGactiveEdge* z = nsvg__addActive(r, &r->edges[e], scany);
-					if (z == NULL) break;
-					// find insertion point
-					if (active == NULL) {
-						active = z;
-					} else if (z->x < active->x) {
-						// insert at front
-						z->next = active;
-						active = z;
+			while (e < nedges && edges[e].y0 <= scany) {
+				if (edges[e].y1 > scany) {
+					NSVGactiveEdge z;
+					int k;
+
+					if (nactive == r->cactive) {
+						int cactive = r->cactive > 0 ? r->cactive * 2 : 64;
+						NSVGactiveEdge* tmp = (NSVGactiveEdge*)realloc(r->active, sizeof(NSVGactiveEdge) * cactive);
+						if (tmp == NULL) break;
+						r->active = active = tmp;
+						r->cactive = cactive;
+					}
+
+					if (y == y0 && s == 0 && y0 > 0) {
+						// Edge crossing the top of a band: position it exactly
+						// as it would have been stepped to from the image top
+						int n = y0 * NSVG__SUBSAMPLES;
+						int first = nsvg__firstSubsample(edges[e].y0);
+						nsvg__initActive(&z, &edges[e], (float)first + 0.5f);
+						z.x += z.dx * (n - first);
 					} else {
-						// find thing to insert AFTER
-						NSVGactiveEdge* p = active;
-						while (p->next && p->next->x < z->x)
-							p = p->next;
-						// at this point, p->next->x is NOT < z->x
-						z->next = p->next;
-						p->next = z;
+						nsvg__initActive(&z, &edges[e], scany);
+					}
+
+					// find insertion point; after the first edge unless
+					// left of it, otherwise before the next edge not left of it
+					k = 0;
+					if (nactive > 0 && z.x >= active[0].x) {
+						k = 1;
+						while (k < nactive && active[k].x < z.x)
+							k++;
 					}
+					memmove(&active[k+1], &active[k], sizeof(NSVGactiveEdge) * (nactive - k));
+					active[k] = z;
+					nactive++;
 				}
 				e++;
 			}
 
 			// now process all active edges in non-zero fashion
-			if (active != NULL)
-				nsvg__fillActiveEdges(r->scanline, r->width, active, maxWeight, &xmin, &xmax, fillRule);
+			if (nactive > 0)
+				nsvg__fillActiveEdges(r->scanline, r->width, active, nactive, maxWeight, &xmin, &xmax, fillRule);
 		}
 		// Blit
 		if (xmin < 0) xmin = 0;
 		if (xmax > r->width-1) xmax = r->width-1;
 		if (xmin <= xmax) {
-			nsvg__scanlineSolid(&r->bitmap[y * r->stride] + xmin*4, xmax-xmin+1, &r->scanline[xmin], xmin, y, tx,ty, scale, cache);
+			nsvg__scanlineSolid(r, &r->bitmap[y * r->stride] + xmin*4, xmax-xmin+1, &r->scanline[xmin], xmin, y, tx,ty, scale, cache);
 		}
 	}
 
@@ -1324,6 +1673,32 @@ static void nsvg__initPaint(NSVGcachedPaint* cache, NSVGpaint* paint, float opac
 
 }
 
+// Applies offset and subsampling to the flattened edges, and sorts them
+static void nsvg__translateAndSortEdges(NSVGrasterizer* r, float tx, float ty)
+{
+	NSVGedge* e;
+	int i;
+
+	for (i = 0; i < r->nedges; i++) {
+		e = &r->edges[i];
+		e->x0 = tx + e->x0;
+		e->y0 = (ty + e->y0) * NSVG__SUBSAMPLES;
+		e->x1 = tx + e->x1;
+		e->y1 = (ty + e->y1) * NSVG__SUBSAMPLES;
+	}
+
+	nsvg__sortEdges(r);
+}
+
+static void nsvg__swapPaintRB(NSVGcachedPaint* cache)
+{
+	int i, n = cache->type == NSVG_PAINT_COLOR ? 1 : 256;
+	for (i = 0; i < n; i++) {
+		unsigned int c = cache->colors[i];
+		cache->colors[i] = (c & 0xff00ff00) | ((c & 0xff) << 16) | ((c >> 16) & 0xff);
+	}
+}
+
 /*
 static void dumpEdges(NSVGrasterizer* r, const char* name)
 {
@@ -1366,12 +1741,28 @@ static void dumpEdges(NSVGrasterizer* r, const char* name)
 }
 */
 
-void nsvgRasterize(NSVGrasterizer* r,
+// Returns 0 if the shape, fill or stroke, cannot cover any pixel of
+// the w x h destination. Joins and caps extend strokes by at most the
+// miter limit (or, for square caps, sqrt(2)) times half the width.
+static int nsvg__shapeVisible(NSVGshape* shape, float tx, float ty, float scale, int w, int h, int stroke)
+{
+	float pad = 1.0f;
+	if (stroke)
+		pad += shape->strokeWidth * scale * 0.5f * (shape->miterLimit > 2.0f ? shape->miterLimit : 2.0f);
+
+	// Written so that NaN bounds are treated as visible
+	if (shape->bounds[2] * scale + tx < -pad) return 0;
+	if (shape->bounds[3] * scale + ty < -pad) return 0;
+	if (shape->bounds[0] * scale + tx > w + pad) return 0;
+	if (shape->bounds[1] * scale + ty > h + pad) return 0;
+	return 1;
+}
+
+static void nsvg__rasterize(NSVGrasterizer* r,
 				   NSVGimage* image, float tx, float ty, float scale,
-				   unsigned char* dst, int w, int h, int stride)
+				   unsigned char* dst, int w, int h, int stride, int premultipliedBGRA)
 {
 	NSVGshape *shape = NULL;
-	NSVGedge *e = NULL;
 	NSVGcachedPaint cache;
 	int i;
 
@@ -1393,61 +1784,42 @@ void nsvgRasterize(NSVGrasterizer* r,
 		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
 			continue;
 
-		if (shape->fill.type != NSVG_PAINT_NONE) {
-			nsvg__resetPool(r);
-			r->freelist = NULL;
+		if (shape->fill.type != NSVG_PAINT_NONE && nsvg__shapeVisible(shape, tx, ty, scale, w, h, 0)) {
 			r->nedges = 0;
 
 			nsvg__flattenShape(r, shape, scale);
 
-			// Scale and translate edges
-			for (i = 0; i < r->nedges; i++) {
-				e = &r->edges[i];
-				e->x0 = tx + e->x0;
-				e->y0 = (ty + e->y0) * NSVG__SUBSAMPLES;
-				e->x1 = tx + e->x1;
-				e->y1 = (ty + e->y1) * NSVG__SUBSAMPLES;
-			}
-
-			// Rasterize edges
-			if (r->nedges != 0)
-				qsort(r->edges, r->nedges, sizeof(NSVGedge), nsvg__cmpEdge);
+			nsvg__translateAndSortEdges(r, tx, ty);
 
 			// now, traverse the scanlines and find the intersections on each scanline, use non-zero rule
 			nsvg__initPaint(&cache, &shape->fill, shape->opacity);
+			if (premultipliedBGRA)
+				nsvg__swapPaintRB(&cache);
 
-			nsvg__rasterizeSortedEdges(r, tx,ty,scale, &cache, shape->fillRule);
+			nsvg__rasterizeSortedEdges(r, r->edges, r->nedges, 0, r->height, tx,ty,scale, &cache, shape->fillRule);
 		}
-		if (shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f) {
-			nsvg__resetPool(r);
-			r->freelist = NULL;
+		if (shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f &&
+			nsvg__shapeVisible(shape, tx, ty, scale, w, h, 1)) {
 			r->nedges = 0;
 
 			nsvg__flattenShapeStroke(r, shape, scale);
 
 //			dumpEdges(r, "edge.svg");
 
-			// Scale and translate edges
-			for (i = 0; i < r->nedges; i++) {
-				e = &r->edges[i];
-				e->x0 = tx + e->x0;
-				e->y0 = (ty + e->y0) * NSVG__SUBSAMPLES;
-				e->x1 = tx + e->x1;
-				e->y1 = (ty + e->y1) * NSVG__SUBSAMPLES;
-			}
-
-			// Rasterize edges
-			if (r->nedges != 0)
-				qsort(r->edges, r->nedges, sizeof(NSVGedge), nsvg__cmpEdge);
+			nsvg__translateAndSortEdges(r, tx, ty);
 
 			// now, traverse the scanlines and find the intersections on each scanline, use non-zero rule
 			nsvg__initPaint(&cache, &shape->stroke, shape->opacity);
+			if (premultipliedBGRA)
+				nsvg__swapPaintRB(&cache);
 
-			nsvg__rasterizeSortedEdges(r, tx,ty,scale, &cache, NSVG_FILLRULE_NONZERO);
+			nsvg__rasterizeSortedEdges(r, r->edges, r->nedges, 0, r->height, tx,ty,scale, &cache, NSVG_FILLRULE_NONZERO);
 		}
 	}
 
-	nsvg__unpremultiplyAlpha(dst, w, h, stride);
+	// The scanline blender works on premultiplied pixels
+	if (!premultipliedBGRA)
+		nsvg__unpremultiplyAlpha(dst, w, h, stride);
 
 	r->bitmap = NULL;
 	r->width = 0;
@@ -1455,6 +1827,162 @@ void nsvgRasterize(NSVGrasterizer* r,
 	r->stride = 0;
 }
 
+void nsvgRasterize(NSVGrasterizer* r,
+				   NSVGimage* image, float tx, float ty, float scale,
+				   unsigned char* dst, int w, int h, int stride)
+{
+	nsvg__rasterize(r, image, tx, ty, scale, dst, w, h, stride, 0);
+}
+
+void nsvgRasterizePremultipliedBGRA(NSVGrasterizer* r,
+				   NSVGimage* image, float tx, float ty, float scale,
+				   unsigned char* dst, int w, int h, int stride)
+{
+	nsvg__rasterize(r, image, tx, ty, scale, dst, w, h, stride, 1);
+}
+
+// Moves the rasterizer's current edges into a new prepared shape
+static int nsvg__addPreparedShape(NSVGprepared* p, NSVGrasterizer* r,
+								  NSVGpaint* paint, float opacity, char fillRule, int premultipliedBGRA)
+{
+	NSVGpreparedShape* ps;
+	float maxy;
+	int i;
+
+	if (r->nedges == 0) return 1;
+
+	if (p->nedges + r->nedges > p->cedges) {
+		int cedges = p->cedges > 0 ? p->cedges : 64;
+		while (cedges < p->nedges + r->nedges)
+			cedges *= 2;
+		NSVGedge* edges = (NSVGedge*)realloc(p->edges, sizeof(NSVGedge) * cedges);
+		if (edges == NULL) return 0;
+		p->edges = edges;
+		p->cedges = cedges;
+	}
+
+	if (p->nshapes + 1 > p->cshapes) {
+		int cshapes = p->cshapes > 0 ? p->cshapes * 2 : 16;
+		NSVGpreparedShape* shapes = (NSVGpreparedShape*)realloc(p->shapes, sizeof(NSVGpreparedShape) * cshapes);
+		if (shapes == NULL) return 0;
+		p->shapes = shapes;
+		p->cshapes = cshapes;
+	}
+
+	ps = &p->shapes[p->nshapes++];
+	ps->firstEdge = p->nedges;
+	ps->nedges = r->nedges;
+	ps->fillRule = fillRule;
+
+	// Edges are sorted on y0, and in subsample units
+	maxy = r->edges[0].y1;
+	for (i = 1; i < r->nedges; i++)
+		if (r->edges[i].y1 > maxy) maxy = r->edges[i].y1;
+	ps->miny = (int)floorf(r->edges[0].y0 / NSVG__SUBSAMPLES);
+	ps->maxy = (int)ceilf(maxy / NSVG__SUBSAMPLES);
+
+	nsvg__initPaint(&ps->paint, paint, opacity);
+	if (premultipliedBGRA)
+		nsvg__swapPaintRB(&ps->paint);
+
+	memcpy(&p->edges[p->nedges], r->edges, sizeof(NSVGedge) * r->nedges);
+	p->nedges += r->nedges;
+	return 1;
+}
+
+NSVGprepared* nsvgPrepare(NSVGrasterizer* r,
+				   NSVGimage* image, float tx, float ty, float scale,
+				   int w, int h, int premultipliedBGRA)
+{
+	NSVGshape *shape = NULL;
+	NSVGprepared* p = (NSVGprepared*)malloc(sizeof(NSVGprepared));
+	if (p == NULL) return NULL;
+	memset(p, 0, sizeof(NSVGprepared));
+
+	p->tx = tx;
+	p->ty = ty;
+	p->scale = scale;
+
+	for (shape = image->shapes; shape != NULL; shape = shape->next) {
+		if (!(shape->flags & NSVG_FLAGS_VISIBLE))
+			continue;
+
+		if (shape->fill.type != NSVG_PAINT_NONE && nsvg__shapeVisible(shape, tx, ty, scale, w, h, 0)) {
+			r->nedges = 0;
+
+			nsvg__flattenShape(r, shape, scale);
+			nsvg__translateAndSortEdges(r, tx, ty);
+
+			if (!nsvg__addPreparedShape(p, r, &shape->fill, shape->opacity, shape->fillRule, premultipliedBGRA))
+				goto error;
+		}
+		if (shape->stroke.type != NSVG_PAINT_NONE && (shape->strokeWidth * scale) > 0.01f &&
+			nsvg__shapeVisible(shape, tx, ty, scale, w, h, 1)) {
+			r->nedges = 0;
+
+			nsvg__flattenShapeStroke(r, shape, scale);
+			nsvg__translateAndSortEdges(r, tx, ty);
+
+			if (!nsvg__addPreparedShape(p, r, &shape->stroke, shape->opacity, NSVG_FILLRULE_NONZERO, premultipliedBGRA))
+				goto error;
+		}
+	}
+
+	return p;
+
+error:
+	nsvgDeletePrepared(p);
+	return NULL;
+}
+
+void nsvgRasterizePrepared(NSVGrasterizer* r, const NSVGprepared* prepared,
+				   unsigned char* dst, int w, int h, int stride,
+				   int y0, int y1)
+{
+	int i;
+
+	if (y0 < 0) y0 = 0;
+	if (y1 > h) y1 = h;
+
+	r->bitmap = dst;
+	r->width = w;
+	r->height = h;
+	r->stride = stride;
+
+	if (w > r->cscanline) {
+		r->cscanline = w;
+		r->scanline = (unsigned char*)realloc(r->scanline, w);
+		if (r->scanline == NULL) return;
+	}
+
+	for (i = y0; i < y1; i++)
+		memset(&dst[i*stride], 0, w*4);
+
+	for (i = 0; i < prepared->nshapes; i++) {
+		NSVGpreparedShape* ps = &prepared->shapes[i];
+
+		// Skip shapes not intersecting the band
+		if (ps->maxy <= y0 || ps->miny >= y1)
+			continue;
+
+		nsvg__rasterizeSortedEdges(r, &prepared->edges[ps->firstEdge], ps->nedges, y0, y1,
+								   prepared->tx, prepared->ty, prepared->scale, &ps->paint, ps->fillRule);
+	}
+
+	r->bitmap = NULL;
+	r->width = 0;
+	r->height = 0;
+	r->stride = 0;
+}
+
+void nsvgDeletePrepared(NSVGprepared* prepared)
+{
+	if (prepared == NULL) return;
+	free(prepared->edges);
+	free(prepared->shapes);
+	free(prepared);
+}
+
 #endif // NANOSVGRAST_IMPLEMENTATION
 
 #endif // NANOSVGRAST_H
@@ -0,0 +1,1298 @@
+/*
+ * wbg-bench: offline benchmarks of the decode, scale, SVG and text
+ * paths. Synthetic images are generated, in every enabled format, at
+ * sizes from 1080p to 16K, and each stage is timed in isolation. No
+ * compositor is needed.
+ *
+ * Results are printed one per line, either as a fixed width table, or
+ * (--json) as one JSON object per line, so that runs can be diffed.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <uchar.h>
+
+#include <sys/resource.h>
+
+#include <pixman.h>
+#include <fcft/fcft.h>
+
+#define LOG_MODULE "bench"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "image.h"
+#include "premultiply.h"
+#include "scale.h"
+#include "stride.h"
+#include "text.h"
+#include "thread-pool.h"
+#include "version.h"
+
+#if defined(WBG_HAVE_PNG)
+ #include "png-wbg.h"
+#endif
+#if defined(WBG_HAVE_JPG)
+ #include <jpeglib.h>
+ #include "jpg.h"
+#endif
+#if defined(WBG_HAVE_WEBP)
+ #include <webp/encode.h>
+ #include "webp.h"
+#endif
+#if defined(WBG_HAVE_JXL)
+ #include <jxl/encode.h>
+ #if defined(WBG_HAVE_JXL_THREADS)
+  #include <jxl/thread_parallel_runner.h>
+ #endif
+ #include "jxl.h"
+#endif
+#if defined(WBG_HAVE_SVG)
+ #include <nanosvg/nanosvg.h>
+ #include <nanosvg/nanosvgrast.h>
+ #include "svg.h"
+#endif
+
+struct size {
+    const char *name;
+    int width;
+    int height;
+};
+
+/* Source image sizes */
+static const struct size image_sizes[] = {
+    {"1080p", 1920, 1080},
+    {"1440p", 2560, 1440},
+    {"4k", 3840, 2160},
+    {"8k", 7680, 4320},
+    {"16k", 15360, 8640},
+};
+
+/* Output sizes the render path is timed at */
+static const struct size output_sizes[] = {
+    {"1080p", 1920, 1080},
+    {"1440p", 2560, 1440},
+    {"4k", 3840, 2160},
+};
+
+/* Path counts of the synthetic SVGs; shows how setup scales with edges */
+static const int svg_path_counts[] = {1000, 10000, 100000};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static size_t iterations = 5;
+static const char *filter = NULL;
+static bool json = false;
+static char tmp_dir[PATH_MAX];
+
+/* A benchmark case; ‘run’ is timed, ‘cleanup’ (optional) is not */
+struct bench {
+    bool (*run)(void *data);
+    void (*cleanup)(void *data);
+    void *data;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Resets the peak RSS (VmHWM), so that it can be reported per case */
+static void
+peak_rss_reset(void)
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    if (write(fd, "5", 1) < 0)
+        LOG_DBG("failed to reset peak RSS: %s", strerror(errno));
+    close(fd);
+}
+
+/* Peak RSS, in KiB, since the last reset */
+static long
+peak_rss(void)
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp != NULL) {
+        char line[256];
+        long kib = -1;
+
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+                break;
+        }
+
+        fclose(fp);
+        if (kib >= 0)
+            return kib;
+    }
+
+    /* Peak of the entire process */
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static int
+cmp_u64(const void *_a, const void *_b)
+{
+    const uint64_t *a = _a;
+    const uint64_t *b = _b;
+    return *a < *b ? -1 : *a > *b;
+}
+
+static bool
+filtered(const char *name, const char *size)
+{
+    return filter != NULL &&
+        strstr(name, filter) == NULL &&
+        strstr(size, filter) == NULL;
+}
+
+/*
+ * Runs ‘b’, and prints the median and 95th percentile times, the
+ * throughput (‘bytes’, usually the decoded or rendered pixels, per
+ * median time) and the peak RSS.
+ */
+static bool
+bench_run(const char *name, const char *size, size_t bytes,
+          const struct bench *b)
+{
+    if (filtered(name, size))
+        return true;
+
+    uint64_t samples[iterations];
+    peak_rss_reset();
+
+    for (size_t i = 0; i < iterations; i++) {
+        const uint64_t start = now_ns();
+        bool ok = b->run(b->data);
+        samples[i] = now_ns() - start;
+
+        if (b->cleanup != NULL)
+            b->cleanup(b->data);
+
+        if (!ok) {
+            LOG_ERR("%s (%s): failed", name, size);
+            return false;
+        }
+    }
+
+    const long rss = peak_rss();
+
+    qsort(samples, iterations, sizeof(samples[0]), &cmp_u64);
+    const double median = (iterations % 2 == 1
+        ? samples[iterations / 2]
+        : (samples[iterations / 2 - 1] + samples[iterations / 2]) / 2) / 1e6;
+    const double p95 = samples[(size_t)ceil(iterations * 0.95) - 1] / 1e6;
+    const double mb_per_s = median > 0 ? bytes / 1e6 / (median / 1e3) : 0.;
+
+    if (json) {
+        printf("{\"benchmark\":\"%s\",\"size\":\"%s\",\"iterations\":%zu,"
+               "\"median_ms\":%.3f,\"p95_ms\":%.3f,\"mb_per_s\":%.1f,"
+               "\"peak_rss_kib\":%ld}\n",
+               name, size, iterations, median, p95, mb_per_s, rss);
+    } else {
+        printf("%-26s %-28s %5zu %11.3f %11.3f %10.1f %12ld\n",
+               name, size, iterations, median, p95, mb_per_s, rss);
+    }
+
+    fflush(stdout);
+    return true;
+}
+
+static void
+size_str(char *buf, size_t len, int width, int height)
+{
+    snprintf(buf, len, "%dx%d", width, height);
+}
+
+static pixman_image_t *
+create_image_with_format(pixman_format_code_t format, int width, int height)
+{
+    const int stride = stride_for_format_and_width(format, width);
+    uint32_t *data = malloc((size_t)height * stride);
+    if (data == NULL)
+        return NULL;
+
+    pixman_image_t *pix = pixman_image_create_bits_no_clear(
+        format, width, height, data, stride);
+
+    if (pix == NULL)
+        free(data);
+    return pix;
+}
+
+static pixman_image_t *
+create_image(int width, int height)
+{
+    return create_image_with_format(PIXMAN_x8r8g8b8, width, height);
+}
+
+static void
+destroy_image(pixman_image_t *pix)
+{
+    if (pix == NULL)
+        return;
+
+    free(pixman_image_get_data(pix));
+    pixman_image_unref(pix);
+}
+
+static uint32_t
+xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * Opaque gradients, with rings and a bit of noise; photo-like enough
+ * that the encoders (and decoders) have actual work to do.
+ */
+static pixman_image_t *
+synthetic_image(int width, int height)
+{
+    pixman_image_t *pix = create_image(width, height);
+    if (pix == NULL)
+        return NULL;
+
+    uint8_t *data = (uint8_t *)pixman_image_get_data(pix);
+    const int stride = pixman_image_get_stride(pix);
+    uint32_t state = 0x12345678;
+
+    for (int y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t *)&data[y * stride];
+        const int dy = y - height / 2;
+
+        for (int x = 0; x < width; x++) {
+            const int dx = x - width / 2;
+            const uint32_t noise = xorshift32(&state) & 0x0f;
+            const uint32_t ring = (uint32_t)sqrt((double)dx * dx + dy * dy) / 4;
+
+            const uint32_t r = (x * 0xf0 / width + noise) & 0xff;
+            const uint32_t g = (y * 0xf0 / height + noise) & 0xff;
+            const uint32_t b = (ring + noise) & 0xff;
+
+            row[x] = 0xffu << 24 | r << 16 | g << 8 | b;
+        }
+    }
+
+    return pix;
+}
+
+static void
+xrgb_to_rgb(uint8_t *dst, const uint32_t *src, int width)
+{
+    for (int x = 0; x < width; x++) {
+        dst[x * 3 + 0] = src[x] >> 16;
+        dst[x * 3 + 1] = src[x] >> 8;
+        dst[x * 3 + 2] = src[x];
+    }
+}
+
+static bool
+write_file(const char *path, const void *data, size_t size)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to create", path);
+        return false;
+    }
+
+    bool ret = fwrite(data, 1, size, fp) == size;
+    if (fclose(fp) != 0)
+        ret = false;
+
+    if (!ret)
+        LOG_ERRNO("%s: failed to write", path);
+    return ret;
+}
+
+#if defined(WBG_HAVE_JPG)
+static bool
+jpg_save(const char *path, pixman_image_t *pix)
+{
+    const int width = pixman_image_get_width(pix);
+    const int height = pixman_image_get_height(pix);
+    const int stride = pixman_image_get_stride(pix);
+    const uint8_t *data = (const uint8_t *)pixman_image_get_data(pix);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to create", path);
+        return false;
+    }
+
+    uint8_t *row = malloc((size_t)width * 3);
+    if (row == NULL) {
+        fclose(fp);
+        return false;
+    }
+
+    /* The default error handler exits; fine for a benchmark */
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, fp);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    for (int y = 0; y < height; y++) {
+        xrgb_to_rgb(row, (const uint32_t *)&data[y * stride], width);
+        JSAMPROW rows[] = {row};
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+
+    if (fclose(fp) != 0) {
+        LOG_ERRNO("%s: failed to write", path);
+        return false;
+    }
+    return true;
+}
+#endif
+
+#if defined(WBG_HAVE_WEBP)
+static bool
+webp_save(const char *path, pixman_image_t *pix)
+{
+    /* XRGB is BGRA in (little endian) memory, and fully opaque */
+    uint8_t *out = NULL;
+    size_t size = WebPEncodeBGRA(
+        (const uint8_t *)pixman_image_get_data(pix),
+        pixman_image_get_width(pix), pixman_image_get_height(pix),
+        pixman_image_get_stride(pix), 90, &out);
+
+    if (size == 0) {
+        LOG_ERR("%s: failed to encode", path);
+        return false;
+    }
+
+    bool ret = write_file(path, out, size);
+    WebPFree(out);
+    return ret;
+}
+#endif
+
+/* The frame settings API needs libjxl >= 0.7, as progressive decoding does */
+#if defined(WBG_HAVE_JXL) && defined(WBG_HAVE_JXL_PROGRESSIVE)
+static bool
+jxl_save(const char *path, pixman_image_t *pix)
+{
+    const int width = pixman_image_get_width(pix);
+    const int height = pixman_image_get_height(pix);
+    const int stride = pixman_image_get_stride(pix);
+    const uint8_t *data = (const uint8_t *)pixman_image_get_data(pix);
+
+    bool ret = false;
+    JxlEncoder *enc = NULL;
+    void *runner = NULL;
+    uint8_t *rgb = NULL;
+    uint8_t *out = NULL;
+
+    const size_t rgb_size = (size_t)width * height * 3;
+    if ((rgb = malloc(rgb_size)) == NULL)
+        goto out;
+
+    for (int y = 0; y < height; y++) {
+        xrgb_to_rgb(&rgb[(size_t)y * width * 3],
+                    (const uint32_t *)&data[y * stride], width);
+    }
+
+    if ((enc = JxlEncoderCreate(NULL)) == NULL)
+        goto out;
+
+#if defined(WBG_HAVE_JXL_THREADS)
+    runner = JxlThreadParallelRunnerCreate(
+        NULL, JxlThreadParallelRunnerDefaultNumWorkerThreads());
+    if (runner != NULL)
+        JxlEncoderSetParallelRunner(enc, &JxlThreadParallelRunner, runner);
+#endif
+
+    JxlBasicInfo info;
+    JxlEncoderInitBasicInfo(&info);
+    info.xsize = width;
+    info.ysize = height;
+    info.bits_per_sample = 8;
+    info.num_color_channels = 3;
+    info.uses_original_profile = JXL_FALSE;
+
+    JxlColorEncoding color;
+    JxlColorEncodingSetToSRGB(&color, JXL_FALSE);
+
+    if (JxlEncoderSetBasicInfo(enc, &info) != JXL_ENC_SUCCESS ||
+        JxlEncoderSetColorEncoding(enc, &color) != JXL_ENC_SUCCESS)
+    {
+        goto out;
+    }
+
+    JxlEncoderFrameSettings *settings = JxlEncoderFrameSettingsCreate(enc, NULL);
+    JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT, 3);
+
+    const JxlPixelFormat format = {3, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+    if (JxlEncoderAddImageFrame(settings, &format, rgb, rgb_size) != JXL_ENC_SUCCESS)
+        goto out;
+    JxlEncoderCloseInput(enc);
+
+    size_t allocated = 1024 * 1024;
+    size_t size = 0;
+    JxlEncoderStatus status;
+
+    do {
+        uint8_t *new_out = realloc(out, allocated);
+        if (new_out == NULL)
+            goto out;
+        out = new_out;
+
+        uint8_t *next = &out[size];
+        size_t avail = allocated - size;
+        status = JxlEncoderProcessOutput(enc, &next, &avail);
+
+        size = next - out;
+        allocated *= 2;
+    } while (status == JXL_ENC_NEED_MORE_OUTPUT);
+
+    if (status != JXL_ENC_SUCCESS)
+        goto out;
+
+    ret = write_file(path, out, size);
+
+out:
+    if (!ret)
+        LOG_ERR("%s: failed to encode", path);
+
+    free(out);
+    if (enc != NULL)
+        JxlEncoderDestroy(enc);
+#if defined(WBG_HAVE_JXL_THREADS)
+    if (runner != NULL)
+        JxlThreadParallelRunnerDestroy(runner);
+#endif
+    free(rgb);
+    return ret;
+}
+#endif
+
+/*
+ * Loaders, decoding at full size
+ */
+
+typedef pixman_image_t *(*load_func_t)(FILE *fp, const char *path);
+
+#if defined(WBG_HAVE_JPG)
+static pixman_image_t *
+load_jpg(FILE *fp, const char *path)
+{
+    const struct image_target target = {0};
+    bool reduced;
+    return jpg_load(fp, path, &target, &reduced);
+}
+#endif
+
+#if defined(WBG_HAVE_WEBP)
+static pixman_image_t *
+load_webp(FILE *fp, const char *path)
+{
+    const struct image_target target = {0};
+    bool reduced;
+    return webp_load(fp, path, &target, &reduced);
+}
+#endif
+
+struct codec {
+    const char *format;
+    bool (*save)(const char *path, pixman_image_t *pix);
+    load_func_t load;
+};
+
+static const struct codec codecs[] = {
+#if defined(WBG_HAVE_PNG)
+    {"png", &png_save, &png_load},
+#endif
+#if defined(WBG_HAVE_JPG)
+    {"jpg", &jpg_save, &load_jpg},
+#endif
+#if defined(WBG_HAVE_WEBP)
+    {"webp", &webp_save, &load_webp},
+#endif
+#if defined(WBG_HAVE_JXL) && defined(WBG_HAVE_JXL_PROGRESSIVE)
+    {"jxl", &jxl_save, &jxl_load},
+#endif
+};
+
+struct load_job {
+    const char *path;
+    load_func_t load;
+    pixman_image_t *image;
+};
+
+static bool
+load_run(void *data)
+{
+    struct load_job *job = data;
+
+    FILE *fp = fopen(job->path, "rb");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to open", job->path);
+        return false;
+    }
+
+    job->image = job->load(fp, job->path);
+    fclose(fp);
+    return job->image != NULL;
+}
+
+static void
+load_cleanup(void *data)
+{
+    struct load_job *job = data;
+    destroy_image(job->image);
+    job->image = NULL;
+}
+
+static bool
+bench_loaders(pixman_image_t *src, const struct size *size)
+{
+    char size_name[32];
+    size_str(size_name, sizeof(size_name), size->width, size->height);
+
+    const size_t bytes = (size_t)size->width * size->height * 4;
+
+    for (size_t i = 0; i < ARRAY_LEN(codecs); i++) {
+        const struct codec *e = &codecs[i];
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s_load", e->format);
+        if (filtered(name, size_name))
+            continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s.%s", tmp_dir, size->name, e->format);
+
+        if (!e->save(path, src))
+            return false;
+
+        struct load_job job = {.path = path, .load = e->load};
+        const struct bench b = {&load_run, &load_cleanup, &job};
+        bool ok = bench_run(name, size_name, bytes, &b);
+
+        unlink(path);
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Pre-multiplication, as done by the loaders of images with alpha
+ */
+
+struct premultiply_job {
+    uint32_t *pixels;
+    size_t count;
+};
+
+static bool
+premultiply_run(void *data)
+{
+    struct premultiply_job *job = data;
+    premultiply(job->pixels, job->count, false);
+    return true;
+}
+
+static bool
+bench_premultiply(pixman_image_t *src, const struct size *size)
+{
+    char size_name[32];
+    size_str(size_name, sizeof(size_name), size->width, size->height);
+
+    char name[64];
+    snprintf(name, sizeof(name), "premultiply (%s)", premultiply_kernel_name());
+    if (filtered(name, size_name))
+        return true;
+
+    /* Semi-transparent copy of the source; premultiplying is in place */
+    const size_t count = (size_t)size->width * size->height;
+    const uint32_t *pixels = pixman_image_get_data(src);
+    uint32_t *copy = malloc(count * sizeof(copy[0]));
+    if (copy == NULL)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+        copy[i] = (pixels[i] & 0x00ffffff) | (uint32_t)(i & 0xff) << 24;
+
+    struct premultiply_job job = {.pixels = copy, .count = count};
+    const struct bench b = {&premultiply_run, NULL, &job};
+    bool ret = bench_run(name, size_name, count * 4, &b);
+
+    free(copy);
+    return ret;
+}
+
+/*
+ * Scaling, as done by the render path, in each mode. Besides the
+ * 32bpp XRGB the loaders produce, sources are also scaled from the
+ * 24-bit, and byte swapped, layouts they used to produce; these show
+ * what decoding straight to the SHM buffers' layout saves.
+ */
+
+static const struct {
+    pixman_format_code_t format;
+    const char *name;
+} scale_sources[] = {
+    {PIXMAN_x8r8g8b8, NULL},
+    {PIXMAN_r8g8b8, "r8g8b8"},
+    {PIXMAN_x8b8g8r8, "x8b8g8r8"},
+};
+
+struct scale_job {
+    pixman_image_t *src;
+    pixman_image_t *dst;
+    bool stretch;
+};
+
+static bool
+scale_run(void *data)
+{
+    struct scale_job *job = data;
+    scale_image(job->src, job->dst, job->stretch);
+    return true;
+}
+
+static bool
+bench_scale_from(pixman_image_t *src, const struct size *size,
+                 const char *format_name)
+{
+    for (size_t i = 0; i < ARRAY_LEN(output_sizes); i++) {
+        const struct size *out = &output_sizes[i];
+
+        char size_name[64];
+        snprintf(size_name, sizeof(size_name), "%dx%d->%dx%d",
+                 size->width, size->height, out->width, out->height);
+
+        pixman_image_t *dst = create_image(out->width, out->height);
+        if (dst == NULL)
+            return false;
+
+        const size_t bytes = (size_t)out->width * out->height * 4;
+        bool ok = true;
+
+        for (int stretch = 0; stretch <= 1 && ok; stretch++) {
+            const char *mode = stretch ? "stretch" : "fit";
+
+            char name[64];
+            if (format_name != NULL)
+                snprintf(name, sizeof(name), "scale (%s, %s)", mode, format_name);
+            else
+                snprintf(name, sizeof(name), "scale (%s)", mode);
+
+            struct scale_job job = {.src = src, .dst = dst, .stretch = stretch};
+            const struct bench b = {&scale_run, NULL, &job};
+            ok = bench_run(name, size_name, bytes, &b);
+        }
+
+        destroy_image(dst);
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+static bool
+bench_scale(pixman_image_t *src, const struct size *size)
+{
+    for (size_t i = 0; i < ARRAY_LEN(scale_sources); i++) {
+        if (scale_sources[i].name == NULL) {
+            if (!bench_scale_from(src, size, NULL))
+                return false;
+            continue;
+        }
+
+        pixman_image_t *converted = create_image_with_format(
+            scale_sources[i].format, size->width, size->height);
+        if (converted == NULL)
+            return false;
+
+        pixman_image_composite32(
+            PIXMAN_OP_SRC, src, NULL, converted,
+            0, 0, 0, 0, 0, 0, size->width, size->height);
+
+        const bool ok = bench_scale_from(converted, size, scale_sources[i].name);
+        destroy_image(converted);
+
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Text, on top of a rendered frame
+ */
+
+struct text_job {
+    struct fcft_font *font;
+    const char32_t *text;
+    size_t len;
+    pixman_image_t *dst;
+    pixman_image_t *color;
+};
+
+static bool
+text_run(void *data)
+{
+    struct text_job *job = data;
+    const int height = pixman_image_get_height(job->dst);
+
+    text_render(job->font, FCFT_SUBPIXEL_DEFAULT, job->text, job->len,
+                job->dst, height * 0.96 - job->font->height, job->color);
+    return true;
+}
+
+static bool
+bench_text(const char *font_name)
+{
+    static const char32_t text[] =
+        U"wbg-bench: the quick brown fox jumps over the lazy dog";
+
+    const char *names[] = {font_name};
+    struct fcft_font *font = fcft_from_name(1, names, NULL);
+    if (font == NULL) {
+        LOG_WARN("%s: failed to load font; skipping text benchmarks", font_name);
+        return true;
+    }
+
+    pixman_color_t fg = {0x5555, 0x5555, 0x5555, 0xffff};
+    pixman_image_t *color = pixman_image_create_solid_fill(&fg);
+    bool ok = true;
+
+    for (size_t i = 0; i < ARRAY_LEN(output_sizes) && ok; i++) {
+        const struct size *out = &output_sizes[i];
+
+        char size_name[32];
+        size_str(size_name, sizeof(size_name), out->width, out->height);
+
+        pixman_image_t *dst = create_image(out->width, out->height);
+        if (dst == NULL) {
+            ok = false;
+            break;
+        }
+
+        memset(pixman_image_get_data(dst), 0,
+               (size_t)pixman_image_get_stride(dst) * out->height);
+
+        /* The first iteration rasterizes the glyphs; the rest hit fcft's cache */
+        struct text_job job = {
+            .font = font,
+            .text = text,
+            .len = ARRAY_LEN(text) - 1,
+            .dst = dst,
+            .color = color,
+        };
+        const struct bench b = {&text_run, NULL, &job};
+        ok = bench_run("text", size_name, 0, &b);
+
+        destroy_image(dst);
+    }
+
+    pixman_image_unref(color);
+    fcft_destroy(font);
+    return ok;
+}
+
+#if defined(WBG_HAVE_SVG)
+/*
+ * SVG: parsing, and (parallel, banded) rasterization, of synthetic
+ * images with an increasing number of paths. A mix of solid and
+ * gradient filled shapes, some stroked.
+ */
+static bool
+svg_generate(const char *path, int path_count)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to create", path);
+        return false;
+    }
+
+    uint32_t state = 0x9e3779b9;
+    const int w = 1920, h = 1080;
+
+    fprintf(fp,
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+            "width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n"
+            "<defs>\n"
+            "<linearGradient id=\"lg\" x1=\"0\" y1=\"0\" x2=\"1\" y2=\"1\">"
+            "<stop offset=\"0\" stop-color=\"#204080\"/>"
+            "<stop offset=\"1\" stop-color=\"#f0a030\" stop-opacity=\"0.7\"/>"
+            "</linearGradient>\n"
+            "<radialGradient id=\"rg\" cx=\"0.5\" cy=\"0.5\" r=\"0.5\">"
+            "<stop offset=\"0\" stop-color=\"#ffffff\"/>"
+            "<stop offset=\"1\" stop-color=\"#108040\" stop-opacity=\"0.5\"/>"
+            "</radialGradient>\n"
+            "</defs>\n"
+            "<rect width=\"%d\" height=\"%d\" fill=\"url(#lg)\"/>\n",
+            w, h, w, h, w, h);
+
+    for (int i = 0; i < path_count; i++) {
+        const int x = xorshift32(&state) % w;
+        const int y = xorshift32(&state) % h;
+        const int r = 4 + xorshift32(&state) % 60;
+
+        int c[6];
+        for (size_t j = 0; j < ARRAY_LEN(c); j++)
+            c[j] = (int)(xorshift32(&state) % (2 * r)) - r;
+
+        fprintf(fp, "<path d=\"M%d %dC%d %d %d %d %d %dC%d %d %d %d %d %dZ\" ",
+                x, y,
+                x + c[0], y - r, x + r, y + c[1], x + c[2], y + r,
+                x - r, y + c[3], x + c[4], y - c[5], x, y);
+
+        switch (i % 4) {
+        case 0:
+            fprintf(fp, "fill=\"#%06x\" fill-opacity=\"0.6\"/>\n",
+                    xorshift32(&state) & 0xffffff);
+            break;
+        case 1:
+            fprintf(fp, "fill=\"url(#lg)\"/>\n");
+            break;
+        case 2:
+            fprintf(fp, "fill=\"url(#rg)\"/>\n");
+            break;
+        case 3:
+            fprintf(fp, "fill=\"none\" stroke=\"#%06x\" stroke-width=\"%d\"/>\n",
+                    xorshift32(&state) & 0xffffff, 1 + i % 5);
+            break;
+        }
+    }
+
+    fprintf(fp, "</svg>\n");
+
+    if (fclose(fp) != 0) {
+        LOG_ERRNO("%s: failed to write", path);
+        return false;
+    }
+    return true;
+}
+
+struct svg_load_job {
+    const char *path;
+};
+
+static bool
+svg_load_run(void *data)
+{
+    struct svg_load_job *job = data;
+
+    FILE *fp = fopen(job->path, "rb");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to open", job->path);
+        return false;
+    }
+
+    bool ret = svg_load(fp, job->path);
+    fclose(fp);
+    return ret;
+}
+
+struct svg_render_job {
+    pixman_image_t *dst;
+};
+
+static bool
+svg_render_run(void *data)
+{
+    struct svg_render_job *job = data;
+    svg_render(job->dst, false);
+    return true;
+}
+
+#if defined(NSVG_HAVE_RASTERIZER_SIMD)
+struct nsvg_job {
+    NSVGrasterizer *rast;
+    NSVGimage *image;
+    uint8_t *data;
+    int width;
+    int height;
+};
+
+static bool
+nsvg_run(void *data)
+{
+    struct nsvg_job *job = data;
+    const float s = fminf((float)job->width / job->image->width,
+                          (float)job->height / job->image->height);
+
+    nsvgRasterize(job->rast, job->image, 0, 0, s, job->data,
+                  job->width, job->height, job->width * 4);
+    return true;
+}
+
+/*
+ * Single threaded rasterization, with the scalar and the SIMD span
+ * kernels. Doubles as a conformance check; both must produce
+ * identical pixels.
+ */
+static bool
+bench_nsvg_simd(const char *path, const char *paths_name)
+{
+    const struct size *out = &output_sizes[ARRAY_LEN(output_sizes) - 1];
+
+    char size_name[64];
+    snprintf(size_name, sizeof(size_name), "%dx%d, %s",
+             out->width, out->height, paths_name);
+
+    if (filtered("nsvg_rasterize (scalar)", size_name) &&
+        filtered("nsvg_rasterize (simd)", size_name))
+    {
+        return true;
+    }
+
+    NSVGimage *image = nsvgParseFromFile(path, "px", 96);
+    NSVGrasterizer *rast = nsvgCreateRasterizer();
+    const size_t bytes = (size_t)out->width * out->height * 4;
+    uint8_t *scalar = calloc(1, bytes);
+    uint8_t *simd = calloc(1, bytes);
+    bool ok = false;
+
+    if (image == NULL || rast == NULL || scalar == NULL || simd == NULL)
+        goto out;
+
+    struct nsvg_job job = {
+        .rast = rast,
+        .image = image,
+        .width = out->width,
+        .height = out->height,
+    };
+    const struct bench b = {&nsvg_run, NULL, &job};
+
+    nsvgRasterizerUseSIMD(rast, 0);
+    job.data = scalar;
+    if (!bench_run("nsvg_rasterize (scalar)", size_name, bytes, &b))
+        goto out;
+
+    nsvgRasterizerUseSIMD(rast, 1);
+    job.data = simd;
+    if (!bench_run("nsvg_rasterize (simd)", size_name, bytes, &b))
+        goto out;
+
+    if (memcmp(scalar, simd, bytes) != 0) {
+        LOG_ERR("%s: SIMD rasterization differs from the scalar one", size_name);
+        goto out;
+    }
+
+    ok = true;
+
+out:
+    free(simd);
+    free(scalar);
+    if (rast != NULL)
+        nsvgDeleteRasterizer(rast);
+    if (image != NULL)
+        nsvgDelete(image);
+    return ok;
+}
+#endif
+
+static bool
+bench_svg(void)
+{
+    for (size_t i = 0; i < ARRAY_LEN(svg_path_counts); i++) {
+        const int count = svg_path_counts[i];
+
+        char paths_name[32];
+        snprintf(paths_name, sizeof(paths_name), "%d paths", count);
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%d.svg", tmp_dir, count);
+
+        if (!svg_generate(path, count))
+            return false;
+
+        struct svg_load_job load_job = {.path = path};
+        const struct bench load = {&svg_load_run, NULL, &load_job};
+        bool ok = bench_run("svg_load", paths_name, 0, &load);
+
+        for (size_t j = 0; j < ARRAY_LEN(output_sizes) && ok; j++) {
+            const struct size *out = &output_sizes[j];
+
+            char size_name[64];
+            snprintf(size_name, sizeof(size_name), "%dx%d, %s",
+                     out->width, out->height, paths_name);
+
+            if (filtered("svg_render", size_name))
+                continue;
+
+            pixman_image_t *dst = create_image(out->width, out->height);
+            if (dst == NULL) {
+                ok = false;
+                break;
+            }
+
+            struct svg_render_job render_job = {.dst = dst};
+            const struct bench render = {&svg_render_run, NULL, &render_job};
+            ok = bench_run("svg_render", size_name,
+                           (size_t)out->width * out->height * 4, &render);
+
+            destroy_image(dst);
+        }
+
+#if defined(NSVG_HAVE_RASTERIZER_SIMD)
+        if (ok)
+            ok = bench_nsvg_simd(path, paths_name);
+#endif
+
+        unlink(path);
+        if (!ok)
+            return false;
+    }
+
+    svg_free();
+    return true;
+}
+#endif
+
+static bool
+parse_sizes(const char *list, bool selected[static ARRAY_LEN(image_sizes)])
+{
+    memset(selected, 0, ARRAY_LEN(image_sizes) * sizeof(selected[0]));
+
+    char *copy = strdup(list);
+    char *saveptr;
+    bool ret = true;
+
+    for (char *name = strtok_r(copy, ",", &saveptr);
+         name != NULL;
+         name = strtok_r(NULL, ",", &saveptr))
+    {
+        bool found = false;
+        for (size_t i = 0; i < ARRAY_LEN(image_sizes); i++) {
+            if (strcasecmp(name, image_sizes[i].name) == 0) {
+                selected[i] = found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            fprintf(stderr, "error: --sizes: %s: unknown size\n", name);
+            ret = false;
+            break;
+        }
+    }
+
+    free(copy);
+    return ret;
+}
+
+static void
+usage(const char *progname)
+{
+    printf("Usage: %s [OPTIONS]\n"
+           "\n"
+           "Options:\n"
+           "  -n,--iterations=N    number of timed runs per benchmark (default: 5)\n"
+           "  -s,--sizes=LIST      comma separated list of image sizes: 1080p,1440p,4k,8k,16k (default: all)\n"
+           "  -F,--filter=STRING   only run benchmarks whose name, or size, contains STRING\n"
+           "  -f,--font=FONT       FontConfig formatted font specification (default: Sans:size=14)\n"
+           "  -j,--threads=COUNT   number of threads (default: number of CPUs)\n"
+           "     --json            print one JSON object per benchmark\n"
+           "  -v,--version         show the version number and quit\n"
+           , progname);
+}
+
+int
+main(int argc, char *const *argv)
+{
+    const char *progname = argv[0];
+
+    const struct option longopts[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"sizes",      required_argument, NULL, 's'},
+        {"filter",     required_argument, NULL, 'F'},
+        {"font",       required_argument, NULL, 'f'},
+        {"threads",    required_argument, NULL, 'j'},
+        {"json",       no_argument, 0, 'J'},
+        {"version",    no_argument, 0, 'v'},
+        {"help",       no_argument, 0, 'h'},
+        {NULL,         no_argument, 0, 0},
+    };
+
+    const char *font_name = "Sans:size=14";
+    unsigned long thread_count = 0;
+    bool selected[ARRAY_LEN(image_sizes)];
+
+    for (size_t i = 0; i < ARRAY_LEN(image_sizes); i++)
+        selected[i] = true;
+
+    while (true) {
+        int c = getopt_long(argc, argv, ":n:s:F:f:j:vh", longopts, NULL);
+        if (c < 0)
+            break;
+
+        switch (c) {
+        case 'n': {
+            errno = 0;
+            char *end;
+            iterations = strtoul(optarg, &end, 10);
+
+            if (*end != '\0' || errno != 0 || iterations == 0) {
+                fprintf(stderr, "error: -n: %s: invalid iteration count\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+
+        case 's':
+            if (!parse_sizes(optarg, selected))
+                return EXIT_FAILURE;
+            break;
+
+        case 'F':
+            filter = optarg;
+            break;
+
+        case 'f':
+            font_name = optarg;
+            break;
+
+        case 'j': {
+            errno = 0;
+            char *end;
+            thread_count = strtoul(optarg, &end, 10);
+
+            if (*end != '\0' || errno != 0 || thread_count == 0) {
+                fprintf(stderr, "error: -j: %s: invalid thread count\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+
+        case 'J':
+            json = true;
+            break;
+
+        case 'v':
+            printf("wbg-bench version: %s\n", WBG_VERSION);
+            return EXIT_SUCCESS;
+
+        case 'h':
+            usage(progname);
+            return EXIT_SUCCESS;
+
+        case ':':
+            fprintf(stderr, "error: -%c: missing required argument\n", optopt);
+            return EXIT_FAILURE;
+
+        case '?':
+            fprintf(stderr, "error: -%c: invalid option\n", optopt);
+            return EXIT_FAILURE;
+        }
+    }
+
+    log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, LOG_CLASS_WARNING);
+    fcft_init(FCFT_LOG_COLORIZE_AUTO, false, FCFT_LOG_CLASS_WARNING);
+
+    int exit_code = EXIT_FAILURE;
+    bool tmp_dir_created = false;
+
+    if (!thread_pool_init(thread_count))
+        goto out;
+
+    if (json) {
+        printf("{\"version\":\"%s\",\"threads\":%zu,\"premultiply\":\"%s\"}\n",
+               WBG_VERSION, thread_pool_size(), premultiply_kernel_name());
+    } else {
+        printf("# wbg-bench %s, %zu threads\n", WBG_VERSION, thread_pool_size());
+        printf("%-26s %-28s %5s %11s %11s %10s %12s\n",
+               "benchmark", "size", "iters", "median (ms)", "p95 (ms)",
+               "MB/s", "peak RSS KiB");
+    }
+
+    /* Fonts first; fontconfig may want $HOME */
+    if (!bench_text(font_name))
+        goto out;
+
+    /*
+     * Without a cache directory, the on-disk SVG cache is disabled,
+     * and every svg_load() parses.
+     */
+    unsetenv("XDG_CACHE_HOME");
+    unsetenv("HOME");
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/wbg-bench.XXXXXX",
+             tmp != NULL ? tmp : "/tmp");
+
+    if (mkdtemp(tmp_dir) == NULL) {
+        LOG_ERRNO("%s: failed to create directory", tmp_dir);
+        goto out;
+    }
+    tmp_dir_created = true;
+
+    for (size_t i = 0; i < ARRAY_LEN(image_sizes); i++) {
+        if (!selected[i])
+            continue;
+
+        const struct size *size = &image_sizes[i];
+        pixman_image_t *src = synthetic_image(size->width, size->height);
+        if (src == NULL) {
+            LOG_ERR("%s: failed to allocate source image", size->name);
+            goto out;
+        }
+
+        bool ok = bench_premultiply(src, size) &&
+            bench_loaders(src, size) &&
+            bench_scale(src, size);
+
+        destroy_image(src);
+        if (!ok)
+            goto out;
+    }
+
+#if defined(WBG_HAVE_SVG)
+    if (!bench_svg())
+        goto out;
+#endif
+
+    exit_code = EXIT_SUCCESS;
+
+out:
+    if (tmp_dir_created)
+        rmdir(tmp_dir);
+
+    thread_pool_fini();
+    fcft_fini();
+    log_deinit();
+    return exit_code;
+}
@@ -0,0 +1,254 @@
+#include "cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define LOG_MODULE "cache"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+static uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* Single lane variant of xxHash64's round and avalanche */
+uint64_t
+cache_hash(const void *_data, size_t size, uint64_t seed)
+{
+    const uint8_t *data = _data;
+    const uint64_t p1 = 0x9e3779b185ebca87ull;
+    const uint64_t p2 = 0xc2b2ae3d27d4eb4full;
+    const uint64_t p3 = 0x165667b19e3779f9ull;
+
+    uint64_t h = p3 + seed + size;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, &data[i], sizeof(w));
+        h = rotl64(h + w * p2, 31) * p1;
+    }
+
+    for (; i < size; i++)
+        h = rotl64(h ^ (data[i] * p3), 11) * p1;
+
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+static bool
+make_dir(const char *path)
+{
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+        LOG_WARN("%s: failed to create directory: %s", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool
+cache_dir(char *dir, size_t len, bool create)
+{
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (xdg_cache_home != NULL && xdg_cache_home[0] == '/')
+        snprintf(dir, len, "%s", xdg_cache_home);
+    else if (home != NULL && home[0] == '/')
+        snprintf(dir, len, "%s/.cache", home);
+    else
+        return false;
+
+    if (create && !make_dir(dir))
+        return false;
+
+    size_t dir_len = strlen(dir);
+    int ret = snprintf(&dir[dir_len], len - dir_len, "/wbg");
+    if (ret < 0 || (size_t)ret >= len - dir_len)
+        return false;
+
+    if (create && !make_dir(dir))
+        return false;
+
+    return true;
+}
+
+bool
+cache_path(char *path, size_t len, const char *prefix, uint64_t hash,
+           bool create)
+{
+    char dir[PATH_MAX];
+    if (!cache_dir(dir, sizeof(dir), create))
+        return false;
+
+    int ret = snprintf(path, len, "%s/%s-%016" PRIx64, dir, prefix, hash);
+    return ret > 0 && (size_t)ret < len;
+}
+
+bool
+cache_write(const char *path, const struct iovec *iov, size_t count)
+{
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+    int fd = mkostemp(tmp_path, O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("%s: failed to create: %s", tmp_path, strerror(errno));
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p = iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+
+        while (left > 0) {
+            ssize_t ret = write(fd, p, left);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                LOG_WARN("%s: failed to write: %s", tmp_path, strerror(errno));
+                goto err;
+            }
+            p += ret;
+            left -= ret;
+        }
+    }
+
+    /* Without it, a crash after the rename may leave an empty file */
+    if (fsync(fd) < 0) {
+        LOG_WARN("%s: failed to sync: %s", tmp_path, strerror(errno));
+        goto err;
+    }
+
+    if (close(fd) < 0) {
+        fd = -1;
+        LOG_WARN("%s: failed to write: %s", tmp_path, strerror(errno));
+        goto err;
+    }
+    fd = -1;
+
+    if (rename(tmp_path, path) < 0) {
+        LOG_WARN("%s: failed to rename: %s", tmp_path, strerror(errno));
+        goto err;
+    }
+
+    return true;
+
+err:
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp_path);
+    return false;
+}
+
+struct cache_file {
+    char name[NAME_MAX + 1];
+    off_t size;
+    struct timespec mtime;
+};
+
+static int
+cache_file_cmp_newest_first(const void *_a, const void *_b)
+{
+    const struct cache_file *a = _a;
+    const struct cache_file *b = _b;
+
+    if (a->mtime.tv_sec != b->mtime.tv_sec)
+        return a->mtime.tv_sec > b->mtime.tv_sec ? -1 : 1;
+    if (a->mtime.tv_nsec != b->mtime.tv_nsec)
+        return a->mtime.tv_nsec > b->mtime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+void
+cache_prune(const char *prefix, size_t max_size)
+{
+    char dir_path[PATH_MAX];
+    if (!cache_dir(dir_path, sizeof(dir_path), false))
+        return;
+
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL)
+        return;
+
+    const size_t prefix_len = strlen(prefix);
+    struct cache_file *files = NULL;
+    size_t count = 0, allocated = 0;
+    size_t total = 0;
+
+    for (const struct dirent *e = readdir(dir); e != NULL; e = readdir(dir)) {
+        /* Skips temporary files, ‘<prefix>-<hash>.XXXXXX’, too */
+        if (strncmp(e->d_name, prefix, prefix_len) != 0 ||
+            e->d_name[prefix_len] != '-' ||
+            strlen(e->d_name) != prefix_len + 1 + 16)
+        {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+            !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+
+        if (count == allocated) {
+            size_t new_allocated = allocated > 0 ? allocated * 2 : 16;
+            struct cache_file *new_files = realloc(
+                files, new_allocated * sizeof(files[0]));
+
+            if (new_files == NULL)
+                goto out;
+
+            files = new_files;
+            allocated = new_allocated;
+        }
+
+        struct cache_file *f = &files[count++];
+        snprintf(f->name, sizeof(f->name), "%s", e->d_name);
+        f->size = st.st_size;
+        f->mtime = st.st_mtim;
+        total += st.st_size;
+    }
+
+    if (total <= max_size)
+        goto out;
+
+    qsort(files, count, sizeof(files[0]), &cache_file_cmp_newest_first);
+
+    /* Keep the newest files that fit, and remove everything older */
+    size_t kept = 0;
+    bool full = false;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!full && kept + files[i].size <= max_size) {
+            kept += files[i].size;
+            continue;
+        }
+        full = true;
+
+        LOG_DBG("%s/%s: pruning", dir_path, files[i].name);
+        if (unlinkat(dirfd(dir), files[i].name, 0) < 0)
+            LOG_WARN("%s/%s: failed to remove: %s",
+                     dir_path, files[i].name, strerror(errno));
+    }
+
+out:
+    free(files);
+    closedir(dir);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/uio.h>
+
+/*
+ * Helpers shared by the on-disk caches, which live in
+ * $XDG_CACHE_HOME/wbg (falling back to ~/.cache/wbg), in files named
+ * ‘<prefix>-<hash>’.
+ */
+
+/* Hashes ‘data’. Chain hashes by passing the previous one as ‘seed’ */
+uint64_t cache_hash(const void *data, size_t size, uint64_t seed);
+
+/* Path of the cache file for ‘hash’. Creates the directories if ‘create’ */
+bool cache_path(char *path, size_t len, const char *prefix, uint64_t hash,
+                bool create);
+
+/* Writes, and syncs, ‘iov’ to a temporary file, then atomically
+ * replaces ‘path’ */
+bool cache_write(const char *path, const struct iovec *iov, size_t count);
+
+/* Removes the least recently modified ‘prefix’ files, until the
+ * remaining ones add up to at most ‘max_size’ bytes */
+void cache_prune(const char *prefix, size_t max_size);
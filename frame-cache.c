@@ -0,0 +1,152 @@
+#include "frame-cache.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define LOG_MODULE "frame-cache"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "cache.h"
+#include "stride.h"
+
+/* Upper limit of disk space used by cached frames */
+#define FRAME_CACHE_MAX_SIZE (256 * 1024 * 1024)
+
+/*
+ * File layout: the header, padded to a page, followed by the pixels
+ * exactly as in a SHM buffer. Keeping the pixels page aligned lets
+ * the kernel copy them straight into the buffer's memory file.
+ */
+#define CACHE_MAGIC "wbg-frm"
+#define CACHE_VERSION 1
+#define CACHE_BYTE_ORDER 0x01020304u
+#define CACHE_DATA_OFFSET 4096
+
+struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;
+    uint32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+};
+
+_Static_assert(sizeof(struct file_header) <= CACHE_DATA_OFFSET, "header too large");
+
+/* Opens, and validates, the cached frame. Returns -1 if there is none */
+static int
+frame_open(uint64_t key, int width, int height)
+{
+    char path[PATH_MAX];
+    if (!cache_path(path, sizeof(path), "frame", key, false))
+        return -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_DBG("%s: not cached", path);
+        return -1;
+    }
+
+    const int stride = stride_for_format_and_width(PIXMAN_x8r8g8b8, width);
+    struct file_header hdr;
+    struct stat st;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        fstat(fd, &st) < 0)
+    {
+        goto err;
+    }
+
+    if (memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != CACHE_VERSION ||
+        hdr.byte_order != CACHE_BYTE_ORDER ||
+        hdr.key != key ||
+        hdr.format != PIXMAN_x8r8g8b8 ||
+        hdr.width != width ||
+        hdr.height != height ||
+        hdr.stride != stride ||
+        st.st_size != CACHE_DATA_OFFSET + (off_t)stride * height)
+    {
+        LOG_DBG("%s: stale or incompatible cache file", path);
+        goto err;
+    }
+
+    return fd;
+
+err:
+    close(fd);
+    return -1;
+}
+
+bool
+frame_cache_contains(uint64_t key, int width, int height)
+{
+    int fd = frame_open(key, width, height);
+    if (fd < 0)
+        return false;
+
+    close(fd);
+    return true;
+}
+
+struct buffer *
+frame_cache_load(struct wl_shm *shm, uint64_t key, int width, int height,
+                 unsigned long cookie)
+{
+    int fd = frame_open(key, width, height);
+    if (fd < 0)
+        return NULL;
+
+    struct buffer *buf = shm_get_buffer_from_file(
+        shm, width, height, cookie, fd, CACHE_DATA_OFFSET);
+
+    if (buf != NULL) {
+        LOG_DBG("%016" PRIx64 ": loaded %dx%d frame", key, width, height);
+
+        /* Pruning removes the least recently *used* frames */
+        futimens(fd, NULL);
+    }
+
+    close(fd);
+    return buf;
+}
+
+void
+frame_cache_store(uint64_t key, const struct buffer *buf)
+{
+    char path[PATH_MAX];
+    if (!cache_path(path, sizeof(path), "frame", key, true))
+        return;
+
+    const struct file_header hdr = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .byte_order = CACHE_BYTE_ORDER,
+        .key = key,
+        .format = PIXMAN_x8r8g8b8,
+        .width = buf->width,
+        .height = buf->height,
+        .stride = buf->stride,
+    };
+
+    uint8_t header[CACHE_DATA_OFFSET] = {0};
+    memcpy(header, &hdr, sizeof(hdr));
+
+    const struct iovec iov[] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = buf->mmapped, .iov_len = (size_t)buf->stride * buf->height},
+    };
+
+    if (!cache_write(path, iov, sizeof(iov) / sizeof(iov[0])))
+        return;
+
+    LOG_DBG("%s: stored %dx%d frame", path, buf->width, buf->height);
+    cache_prune("frame", FRAME_CACHE_MAX_SIZE);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#include "shm.h"
+
+/*
+ * On-disk cache of fully rendered frames (the scaled image, with the
+ * text on top), in $XDG_CACHE_HOME/wbg. ‘key’ identifies everything
+ * a frame depends on; the size is verified separately.
+ */
+bool frame_cache_contains(uint64_t key, int width, int height);
+
+/* Returns a new buffer holding the cached frame, or NULL */
+struct buffer *frame_cache_load(
+    struct wl_shm *shm, uint64_t key, int width, int height,
+    unsigned long cookie);
+
+void frame_cache_store(uint64_t key, const struct buffer *buf);
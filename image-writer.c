@@ -0,0 +1,89 @@
+#include "image-writer.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define LOG_MODULE "image-writer"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+#if defined(WBG_HAVE_PNG)
+ #include "png-wbg.h"
+#endif
+
+static bool
+has_extension(const char *path, const char *ext)
+{
+    const char *dot = strrchr(path, '.');
+    return dot != NULL && strcasecmp(dot + 1, ext) == 0;
+}
+
+/* Binary PPM (P6), or PAM (P7) with an RGB tuple type */
+static bool
+netpbm_save(const char *path, pixman_image_t *pix, bool pam)
+{
+    const int width = pixman_image_get_width(pix);
+    const int height = pixman_image_get_height(pix);
+    const int stride = pixman_image_get_stride(pix);
+    const uint8_t *data = (const uint8_t *)pixman_image_get_data(pix);
+
+    uint8_t *row = malloc((size_t)width * 3);
+    if (row == NULL)
+        return false;
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to open", path);
+        free(row);
+        return false;
+    }
+
+    if (pam) {
+        fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\n"
+                    "TUPLTYPE RGB\nENDHDR\n", width, height);
+    } else
+        fprintf(fp, "P6\n%d %d\n255\n", width, height);
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t *src = (const uint32_t *)&data[y * stride];
+
+        for (int x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x] >> 16;
+            row[x * 3 + 1] = src[x] >> 8;
+            row[x * 3 + 2] = src[x];
+        }
+
+        if (fwrite(row, 3, width, fp) != (size_t)width)
+            break;
+    }
+
+    free(row);
+
+    bool ret = !ferror(fp);
+    if (fclose(fp) != 0)
+        ret = false;
+
+    if (!ret)
+        LOG_ERRNO("%s: failed to write", path);
+    return ret;
+}
+
+bool
+image_write(const char *path, pixman_image_t *pix)
+{
+    assert(pixman_image_get_format(pix) == PIXMAN_x8r8g8b8);
+
+    if (has_extension(path, "png")) {
+#if defined(WBG_HAVE_PNG)
+        return png_save(path, pix);
+#else
+        LOG_ERR("%s: built without PNG support", path);
+        return false;
+#endif
+    }
+
+    return netpbm_save(path, pix, has_extension(path, "pam"));
+}
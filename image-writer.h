@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <pixman.h>
+
+/*
+ * Writes an XRGB image to ‘path’. The format is picked by the file
+ * extension: ‘.png’ (when built with PNG support), ‘.pam’, and PPM
+ * for anything else.
+ */
+bool image_write(const char *path, pixman_image_t *pix);
@@ -0,0 +1,344 @@
+#include "image.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_MODULE "image"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "timings.h"
+
+#if defined(WBG_HAVE_PNG)
+ #include "png-wbg.h"
+#endif
+#if defined(WBG_HAVE_JPG)
+ #include "jpg.h"
+#endif
+#if defined(WBG_HAVE_WEBP)
+ #include "webp.h"
+#endif
+#if defined(WBG_HAVE_SVG)
+ #include "svg.h"
+#endif
+#if defined(WBG_HAVE_JXL)
+ #include "jxl.h"
+#endif
+
+/* Number of bytes read when probing */
+#define PROBE_SIZE 256
+
+typedef bool (*probe_func_t)(const uint8_t *data, size_t size);
+typedef bool (*load_func_t)(FILE *fp, const char *path,
+                            const struct image_target *target,
+                            pixman_image_t **image, bool *reduced);
+
+static image_preview_func_t preview_func = NULL;
+static void *preview_data = NULL;
+
+struct loader {
+    enum image_format format;
+    const char *name;
+    probe_func_t probe;
+    load_func_t load;  /* NULL if support is disabled */
+};
+
+static bool
+probe_jpg(const uint8_t *data, size_t size)
+{
+    /* SOI marker, followed by the first marker of the next segment */
+    return size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff;
+}
+
+static bool
+probe_png(const uint8_t *data, size_t size)
+{
+    static const uint8_t signature[] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    return size >= sizeof(signature) &&
+        memcmp(data, signature, sizeof(signature)) == 0;
+}
+
+static bool
+probe_webp(const uint8_t *data, size_t size)
+{
+    return size >= 12 &&
+        memcmp(&data[0], "RIFF", 4) == 0 &&
+        memcmp(&data[8], "WEBP", 4) == 0;
+}
+
+static bool
+probe_jxl(const uint8_t *data, size_t size)
+{
+    static const uint8_t container[] = {
+        0x00, 0x00, 0x00, 0x0c, 'J', 'X', 'L', ' ', '\r', '\n', 0x87, '\n'};
+
+    /* Bare codestream */
+    if (size >= 2 && data[0] == 0xff && data[1] == 0x0a)
+        return true;
+
+    return size >= sizeof(container) &&
+        memcmp(data, container, sizeof(container)) == 0;
+}
+
+static bool
+probe_svg(const uint8_t *data, size_t size)
+{
+    /* Skip UTF-8 BOM */
+    if (size >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf) {
+        data += 3;
+        size -= 3;
+    }
+
+    /* XML declaration, doctype, comment or the root element */
+    for (size_t i = 0; i < size; i++) {
+        switch (data[i]) {
+        case ' ': case '\t': case '\r': case '\n':
+            continue;
+
+        default:
+            return data[i] == '<';
+        }
+    }
+
+    return false;
+}
+
+#if defined(WBG_HAVE_JPG)
+static bool
+load_jpg(FILE *fp, const char *path, const struct image_target *target,
+         pixman_image_t **image, bool *reduced)
+{
+    return (*image = jpg_load(fp, path, target, reduced)) != NULL;
+}
+#endif
+
+#if defined(WBG_HAVE_PNG)
+static bool
+load_png(FILE *fp, const char *path, const struct image_target *target,
+         pixman_image_t **image, bool *reduced)
+{
+    return (*image = png_load(fp, path)) != NULL;
+}
+#endif
+
+#if defined(WBG_HAVE_WEBP)
+static bool
+load_webp(FILE *fp, const char *path, const struct image_target *target,
+          pixman_image_t **image, bool *reduced)
+{
+    return (*image = webp_load(fp, path, target, reduced)) != NULL;
+}
+#endif
+
+#if defined(WBG_HAVE_JXL)
+static bool
+load_jxl(FILE *fp, const char *path, const struct image_target *target,
+         pixman_image_t **image, bool *reduced)
+{
+    return (*image = jxl_load(fp, path)) != NULL;
+}
+#endif
+
+#if defined(WBG_HAVE_SVG)
+static bool
+load_svg(FILE *fp, const char *path, const struct image_target *target,
+         pixman_image_t **image, bool *reduced)
+{
+    *image = NULL;
+    return svg_load(fp, path);
+}
+#endif
+
+static const struct loader loaders[] = {
+    {IMAGE_FORMAT_JPG, "JPEG", &probe_jpg,
+#if defined(WBG_HAVE_JPG)
+     &load_jpg,
+#else
+     NULL,
+#endif
+    },
+    {IMAGE_FORMAT_PNG, "PNG", &probe_png,
+#if defined(WBG_HAVE_PNG)
+     &load_png,
+#else
+     NULL,
+#endif
+    },
+    {IMAGE_FORMAT_WEBP, "WebP", &probe_webp,
+#if defined(WBG_HAVE_WEBP)
+     &load_webp,
+#else
+     NULL,
+#endif
+    },
+    {IMAGE_FORMAT_JXL, "JPEG XL", &probe_jxl,
+#if defined(WBG_HAVE_JXL)
+     &load_jxl,
+#else
+     NULL,
+#endif
+    },
+
+    /* Must be last; it is the least specific probe */
+    {IMAGE_FORMAT_SVG, "SVG", &probe_svg,
+#if defined(WBG_HAVE_SVG)
+     &load_svg,
+#else
+     NULL,
+#endif
+    },
+};
+
+static const struct loader *
+loader_for_format(enum image_format format)
+{
+    for (size_t i = 0; i < sizeof(loaders) / sizeof(loaders[0]); i++) {
+        if (loaders[i].format == format)
+            return &loaders[i];
+    }
+    return NULL;
+}
+
+const char *
+image_format_name(enum image_format format)
+{
+    const struct loader *loader = loader_for_format(format);
+    return loader != NULL ? loader->name : "unknown";
+}
+
+enum image_format
+image_probe(FILE *fp, const char *path)
+{
+    uint8_t data[PROBE_SIZE];
+
+    if (fseek(fp, 0, SEEK_SET) < 0) {
+        LOG_ERRNO("%s: failed to seek to beginning of file", path);
+        return IMAGE_FORMAT_UNKNOWN;
+    }
+
+    clearerr(fp);
+    size_t size = fread(data, 1, sizeof(data), fp);
+    if (size < sizeof(data) && ferror(fp)) {
+        LOG_ERRNO("%s: failed to read", path);
+        return IMAGE_FORMAT_UNKNOWN;
+    }
+
+    for (size_t i = 0; i < sizeof(loaders) / sizeof(loaders[0]); i++) {
+        if (loaders[i].probe(data, size))
+            return loaders[i].format;
+    }
+
+    return IMAGE_FORMAT_UNKNOWN;
+}
+
+bool
+image_load(FILE *fp, const char *path, const struct image_target *target,
+           pixman_image_t **image, bool *reduced)
+{
+    *image = NULL;
+    *reduced = false;
+
+    uint64_t start = timings_now();
+    const enum image_format format = image_probe(fp, path);
+    const struct loader *loader = loader_for_format(format);
+    timings_record(start, "format probe");
+
+    if (loader == NULL) {
+        LOG_ERR("%s: unrecognized image format", path);
+        return false;
+    }
+
+    if (loader->load == NULL) {
+        LOG_ERR("%s: %s support not enabled", path, loader->name);
+        return false;
+    }
+
+    LOG_DBG("%s: loading as %s", path, loader->name);
+
+    start = timings_now();
+    bool ret = loader->load(fp, path, target, image, reduced);
+    timings_record(start, "decode (%s)", loader->name);
+    return ret;
+}
+
+void
+image_set_preview_handler(image_preview_func_t func, void *data)
+{
+    preview_func = func;
+    preview_data = data;
+}
+
+bool
+image_wants_preview(void)
+{
+    return preview_func != NULL;
+}
+
+void
+image_preview(pixman_image_t *preview)
+{
+    if (preview_func != NULL)
+        preview_func(preview, preview_data);
+}
+
+double
+image_target_scale(const struct image_target *target, int width, int height)
+{
+    if (target->width <= 0 || target->height <= 0)
+        return 1.;
+
+    double sx = (double)target->width / width;
+    double sy = (double)target->height / height;
+    return target->stretch ? fmax(sx, sy) : fmin(sx, sy);
+}
+
+bool
+image_target_covers(const struct image_target *loaded,
+                    const struct image_target *wanted)
+{
+    if (loaded->stretch != wanted->stretch)
+        return false;
+
+    if (loaded->stretch && loaded->uniform) {
+        return wanted->uniform &&
+            wanted->width == loaded->width &&
+            wanted->height == loaded->height;
+    }
+
+    return wanted->width <= loaded->width && wanted->height <= loaded->height;
+}
+
+const uint8_t *
+image_map_file(FILE *fp, const char *path, size_t *size)
+{
+    struct stat st;
+    if (fstat(fileno(fp), &st) < 0) {
+        LOG_ERRNO("%s: failed to stat", path);
+        return NULL;
+    }
+
+    if (st.st_size == 0) {
+        LOG_ERR("%s: empty file", path);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (data == MAP_FAILED) {
+        LOG_ERRNO("%s: failed to mmap", path);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return data;
+}
+
+void
+image_unmap_file(const uint8_t *data, size_t size)
+{
+    if (data != NULL)
+        munmap((void *)data, size);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <pixman.h>
+
+/* Size the image is going to be displayed at */
+struct image_target {
+    int width;      /* Largest output width, in pixels. 0 if unknown */
+    int height;     /* Largest output height, in pixels. 0 if unknown */
+    bool stretch;
+    bool uniform;   /* All outputs are exactly width x height */
+};
+
+enum image_format {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_JPG,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_WEBP,
+    IMAGE_FORMAT_JXL,
+    IMAGE_FORMAT_SVG,
+};
+
+/* Identifies the image format from the first few bytes of the file */
+enum image_format image_probe(FILE *fp, const char *path);
+const char *image_format_name(enum image_format format);
+
+/*
+ * Probes the file, and decodes it with the matching loader. Loaders
+ * that can, decode at the smallest size that still covers ‘target’,
+ * and set ‘*reduced’. SVG images are kept by the SVG module, and
+ * leave ‘*image’ NULL.
+ */
+bool image_load(FILE *fp, const char *path, const struct image_target *target,
+                pixman_image_t **image, bool *reduced);
+
+/*
+ * Progressive loaders hand out low resolution renditions of the
+ * image, at full size, while decoding continues. ‘preview’ is only
+ * valid during the call.
+ */
+typedef void (*image_preview_func_t)(pixman_image_t *preview, void *data);
+void image_set_preview_handler(image_preview_func_t func, void *data);
+
+/* Used by loaders */
+bool image_wants_preview(void);
+void image_preview(pixman_image_t *preview);
+
+/*
+ * Scale factor needed for an image of the given size to fit (or
+ * cover, when stretched) the target. 1.0 if the target is unknown.
+ */
+double image_target_scale(const struct image_target *target, int width, int height);
+
+/*
+ * Whether an image reduced for ‘loaded’ can be used for ‘wanted’.
+ * Stretched images decoded for a uniform target may be cropped.
+ */
+bool image_target_covers(const struct image_target *loaded,
+                         const struct image_target *wanted);
+
+/* Maps the entire file, read-only, for loaders that need all of it */
+const uint8_t *image_map_file(FILE *fp, const char *path, size_t *size);
+void image_unmap_file(const uint8_t *data, size_t size);
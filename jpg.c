@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
 #include <setjmp.h>
 
 #include <jpeglib.h>
@@ -11,6 +12,13 @@
 #include "log.h"
 #include "stride.h"
 
+/*
+ * If the image still has to be shrunk by at least this much after
+ * DCT scaling, the final filter hides the difference between the
+ * accurate and the fast IDCT and chroma upsampling.
+ */
+#define FAST_DECODE_MAX_SCALE 0.5
+
 struct my_error_mgr {
     struct jpeg_error_mgr mgr;
     jmp_buf setjmp_buffer;
@@ -23,8 +31,55 @@ error_exit(j_common_ptr cinfo)
     longjmp(err_handler->setjmp_buffer, 1);
 }
 
+/*
+ * Selects the smallest n/8 DCT scaling at which the decoded image
+ * still covers the target. Returns true if the image is reduced.
+ */
+static bool
+set_scale(struct jpeg_decompress_struct *cinfo, const struct image_target *target,
+          const char *path)
+{
+    const double s = image_target_scale(
+        target, cinfo->image_width, cinfo->image_height);
+
+    if (s >= 1.)
+        return false;
+
+    const unsigned min_width = ceil(cinfo->image_width * s);
+    const unsigned min_height = ceil(cinfo->image_height * s);
+
+    /* Libjpeg versions without arbitrary n/8 scaling round up */
+    for (unsigned num = 1; num <= 8; num++) {
+        cinfo->scale_num = num;
+        cinfo->scale_denom = 8;
+        jpeg_calc_output_dimensions(cinfo);
+
+        if (cinfo->output_width >= min_width &&
+            cinfo->output_height >= min_height)
+        {
+            break;
+        }
+    }
+
+    const double remaining = s * cinfo->image_width / cinfo->output_width;
+
+    if (remaining <= FAST_DECODE_MAX_SCALE) {
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->do_fancy_upsampling = FALSE;
+    }
+
+    LOG_DBG("%s: decoding %ux%u at %u/%u (%ux%u), remaining scale: %.3f%s",
+            path, cinfo->image_width, cinfo->image_height,
+            cinfo->scale_num, cinfo->scale_denom,
+            cinfo->output_width, cinfo->output_height, remaining,
+            remaining <= FAST_DECODE_MAX_SCALE ? " (fast IDCT)" : "");
+
+    return cinfo->output_width < cinfo->image_width;
+}
+
 pixman_image_t *
-jpg_load(FILE *fp, const char *path)
+jpg_load(FILE *fp, const char *path, const struct image_target *target,
+         bool *reduced)
 {
     struct jpeg_decompress_struct cinfo = {0};
     struct my_error_mgr err_handler;
@@ -49,15 +104,27 @@ jpg_load(FILE *fp, const char *path)
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, fp);
     jpeg_read_header(&cinfo, true);
-    jpeg_calc_output_dimensions(&cinfo);
 
-    if (cinfo.output_components != 1 && cinfo.output_components != 3) {
-        LOG_ERR("%s: unsupported number of color components: %d",
-                path, cinfo.output_components);
+    switch (cinfo.jpeg_color_space) {
+    case JCS_GRAYSCALE:
+    case JCS_RGB:
+    case JCS_YCbCr:
+        break;
+
+    default:
+        LOG_ERR("%s: unsupported color space: %d", path, cinfo.jpeg_color_space);
         goto err;
     }
 
-    pixman_format_code_t format = PIXMAN_b8g8r8;
+#if defined(JCS_EXTENSIONS)
+    /* libjpeg-turbo: decode straight into (little endian) XRGB */
+    cinfo.out_color_space = JCS_EXT_BGRX;
+#endif
+
+    *reduced = set_scale(&cinfo, target, path);
+    jpeg_calc_output_dimensions(&cinfo);
+
+    pixman_format_code_t format = PIXMAN_x8r8g8b8;
     int width = cinfo.output_width;
     int height = cinfo.output_height;
     int stride = stride_for_format_and_width(format, width);
@@ -74,23 +141,29 @@ jpg_load(FILE *fp, const char *path)
     for (int row_no = 0; cinfo.output_scanline < height; row_no++) {
         uint8_t *row = &image_data[row_no * stride];
 
-        if (cinfo.output_components == 3) {
+        if (cinfo.output_components == 4) {
             /* Read directly info our to-be pixman image buffer */
             jpeg_read_scanlines(&cinfo, (JSAMPARRAY)&row, 1);
         }
 
         else {
-            /* Read into temporary buffer, then expand to rgb */
-            assert(cinfo.output_components == 1);
+            /* Read into temporary buffer, then expand to xrgb */
+            assert(cinfo.output_components == 1 ||
+                   cinfo.output_components == 3);
 
-            uint8_t buf[cinfo.output_width];
+            const int components = cinfo.output_components;
+            uint8_t buf[cinfo.output_width * components];
             uint8_t *scanline = &buf[0];
             jpeg_read_scanlines(&cinfo, (JSAMPARRAY)&scanline, 1);
 
+            uint32_t *xrgb = (uint32_t *)row;
             for (size_t i = 0; i < cinfo.output_width; i++) {
-                row[i * 3 + 0] = buf[i];
-                row[i * 3 + 1] = buf[i];
-                row[i * 3 + 2] = buf[i];
+                const uint8_t *p = &buf[i * components];
+                const uint8_t r = p[0];
+                const uint8_t g = p[components == 3 ? 1 : 0];
+                const uint8_t b = p[components == 3 ? 2 : 0];
+
+                xrgb[i] = 0xffu << 24 | r << 16 | g << 8 | b;
             }
         }
     }
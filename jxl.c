@@ -1,6 +1,7 @@
 #include "jxl.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <jxl/decode.h>
 #include <jxl/codestream_header.h>
@@ -11,17 +12,57 @@
 #define LOG_MODULE "jxl"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
+#include "image.h"
+#include "premultiply.h"
 #include "stride.h"
 
+#if defined(WBG_HAVE_JXL_PROGRESSIVE)
+/*
+ * Hands out what has been decoded so far. The output buffer is still
+ * being written to by the decoder, so convert a copy of it.
+ */
+static void
+preview(JxlDecoder *decoder, const char *path, const uint8_t *image,
+        pixman_format_code_t format, int width, int height, int stride)
+{
+    const size_t ratio = JxlDecoderGetIntendedDownsamplingRatio(decoder);
+    if (ratio <= 1)
+        return;
+
+    if (JxlDecoderFlushImage(decoder) != JXL_DEC_SUCCESS) {
+        LOG_DBG("%s: no progressive pass available", path);
+        return;
+    }
+
+    uint8_t *data = malloc((size_t)height * stride);
+    if (data == NULL)
+        return;
+
+    memcpy(data, image, (size_t)height * stride);
+    premultiply((uint32_t *)data, (size_t)width * height, true);
+
+    pixman_image_t *pix = pixman_image_create_bits_no_clear(
+        format, width, height, (uint32_t *)data, stride);
+
+    if (pix != NULL) {
+        LOG_DBG("%s: preview at 1:%zu", path, ratio);
+        image_preview(pix);
+        pixman_image_unref(pix);
+    }
+
+    free(data);
+}
+#endif
+
 pixman_image_t *
 jxl_load(FILE *fp, const char *path)
 {
     pixman_image_t *pix = NULL;
-    pixman_format_code_t format = PIXMAN_x8b8g8r8;
+    pixman_format_code_t format = PIXMAN_a8r8g8b8;
     bool ok = false;
-    uint8_t *file_data = NULL;
+    const uint8_t *file_data = NULL;
     uint8_t *image = NULL;
-    size_t file_size, image_size = 0;
+    size_t file_size = 0, image_size = 0;
     int width = 0, height = 0, stride = 0;
 
 #if defined(WBG_HAVE_JXL_THREADS)
@@ -36,24 +77,8 @@ jxl_load(FILE *fp, const char *path)
         .align = 0
     };
 
-    if (fseek(fp, 0, SEEK_END) < 0) {
-        LOG_ERRNO("%s: failed to seek to end of file", path);
-        return NULL;
-    }
-    file_size = ftell(fp);
-    if (fseek(fp, 0, SEEK_SET) < 0) {
-        LOG_ERRNO("%s: failed to seek to beginning of file", path);
-        return NULL;
-    }
-
-    if (!(file_data = malloc(file_size)))
+    if ((file_data = image_map_file(fp, path, &file_size)) == NULL)
         goto err;
-    clearerr(fp);
-    if (fread(file_data, sizeof(*file_data), file_size, fp) != file_size
-            && ferror(fp)) {
-        LOG_ERRNO("%s: failed to read", path);
-        goto err;
-    }
 
     if (JxlSignatureCheck(file_data, file_size) == JXL_SIG_INVALID) {
         LOG_DBG("%s: not a jpegxl image", path);
@@ -68,7 +93,18 @@ jxl_load(FILE *fp, const char *path)
     JxlDecoderSetParallelRunner(decoder, JxlResizableParallelRunner, runner);
 #endif
 
-    JxlDecoderSubscribeEvents(decoder, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE);
+    int events = JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE;
+
+#if defined(WBG_HAVE_JXL_PROGRESSIVE)
+    /* One (1:8) pass, as soon as the DC coefficients are decoded */
+    if (image_wants_preview() &&
+        JxlDecoderSetProgressiveDetail(decoder, kDC) == JXL_DEC_SUCCESS)
+    {
+        events |= JXL_DEC_FRAME_PROGRESSION;
+    }
+#endif
+
+    JxlDecoderSubscribeEvents(decoder, events);
 
     JxlDecoderSetInput(decoder, file_data, file_size);
     JxlDecoderCloseInput(decoder);
@@ -82,7 +118,15 @@ jxl_load(FILE *fp, const char *path)
         } else if (status == JXL_DEC_NEED_MORE_INPUT) {
             LOG_ERR("%s: decoder requires more input but already provided all input", path);
             goto err;
-        } else if (status == JXL_DEC_BASIC_INFO) {
+        }
+#if defined(WBG_HAVE_JXL_PROGRESSIVE)
+        else if (status == JXL_DEC_FRAME_PROGRESSION) {
+            preview(decoder, path, image,
+                    info.alpha_bits == 0 ? PIXMAN_x8r8g8b8 : PIXMAN_a8r8g8b8,
+                    width, height, stride);
+        }
+#endif
+        else if (status == JXL_DEC_BASIC_INFO) {
             if (JxlDecoderGetBasicInfo(decoder, &info)
                     != JXL_DEC_SUCCESS) {
                 LOG_ERR("%s: failed to get basic info", path);
@@ -130,27 +174,12 @@ jxl_load(FILE *fp, const char *path)
         }
     }
 
-    for (uint32_t *abgr = (uint32_t *)image;
-         abgr < (uint32_t *)(image + (size_t)width * (size_t)height * 4);
-         abgr++) {
-        uint8_t alpha = (*abgr >> 24) & 0xff;
-        uint8_t red   = (*abgr >> 16) & 0xff;
-        uint8_t green = (*abgr >> 8) & 0xff;
-        uint8_t blue  = (*abgr >> 0) & 0xff;
-
-        if (alpha == 0xff)
-            continue;
-
-        if (alpha == 0x00)
-            blue = green = red = 0x00;
-        else {
-            blue = blue * alpha / 0xff;
-            green = green * alpha / 0xff;
-            red = red * alpha / 0xff;
-        }
+    if (info.alpha_bits == 0)
+        format = PIXMAN_x8r8g8b8;
 
-        *abgr = (uint32_t)alpha << 24 | red << 16 | green << 8 | blue;
-    }
+    /* libjxl only produces RGBA; swap to BGRA (i.e. little endian
+     * ARGB), and pre-multiply alpha */
+    premultiply((uint32_t *)image, (size_t)width * height, true);
 
     pix = pixman_image_create_bits_no_clear(format, width, height,
             (uint32_t *)image, stride);
@@ -159,7 +188,7 @@ jxl_load(FILE *fp, const char *path)
 err:
     if (!ok)
         free(image);
-    free(file_data);
+    image_unmap_file(file_data, file_size);
 #if defined(WBG_HAVE_JXL_THREADS)
     JxlResizableParallelRunnerDestroy(runner);
 #endif
@@ -2,7 +2,9 @@
 #include <errno.h>
 #include <getopt.h>
 #include <locale.h>
+#include <math.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,7 +14,9 @@
 #include <uchar.h>
 #include <ctype.h>
 
+#include <sys/eventfd.h>
 #include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include <wayland-client.h>
 #include <wayland-cursor.h>
@@ -25,25 +29,24 @@
 #define LOG_MODULE "wbg"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
+#include "cache.h"
+#include "frame-cache.h"
+#include "image.h"
+#include "image-writer.h"
+#include "scale.h"
+#include "scale-cache.h"
 #include "shm.h"
+#include "slideshow.h"
+#include "stride.h"
+#include "text.h"
+#include "thread-pool.h"
+#include "timings.h"
 #include "version.h"
 #include "wbg-features.h"
 
-#if defined(WBG_HAVE_PNG)
- #include "png-wbg.h"
-#endif
-#if defined(WBG_HAVE_JPG)
- #include "jpg.h"
-#endif
-#if defined(WBG_HAVE_WEBP)
- #include "webp.h"
-#endif
 #if defined(WBG_HAVE_SVG)
  #include "svg.h"
 #endif
-#if defined(WBG_HAVE_JXL)
- #include "jxl.h"
-#endif
 
 /* Top-level globals */
 static struct wl_display *display;
@@ -60,11 +63,65 @@ static float offset = 0.96f;
 static struct fcft_font *font = NULL;
 static enum fcft_subpixel subpixel_mode = FCFT_SUBPIXEL_DEFAULT;
 
+/*
+ * The font is loaded, and the image file hashed, in the background
+ * while connecting to the compositor. Join the threads, with
+ * font_wait() and frame_seed_wait(), before using the results.
+ */
+static pthread_t font_thread;
+static bool font_thread_running = false;
+static pthread_t frame_seed_thread;
+static bool frame_seed_thread_running = false;
+
 static bool have_xrgb8888 = false;
 
+/* Upper limit of memory used to cache scaled images */
+#define SCALE_CACHE_MAX_SIZE (128 * 1024 * 1024)
+
 /* TODO: one per output */
 static pixman_image_t *image;
 
+/*
+ * Images are loaded once the output sizes are known, and rendering is
+ * deferred until then.
+ */
+static FILE *image_fp;
+static const char *image_path;
+static bool image_loaded = false;
+
+/* Output geometry the current image was decoded for */
+static struct image_target image_target;
+
+/* True if the image was decoded scaled down, or cropped */
+static bool image_reduced = false;
+
+/* ‘image’ is a low resolution pass of a progressively decoded image */
+static bool image_is_preview = false;
+
+/* --dir: cycle through the images in a directory */
+static const char *slideshow_dir = NULL;
+static unsigned long slideshow_interval = 300;  /* Seconds */
+static size_t slideshow_idx = 0;                /* Image being shown */
+static int slideshow_timer_fd = -1;
+
+/* Initial output configuration is done; see main() */
+static bool outputs_ready = false;
+
+/*
+ * Hash of the image file, text and options; everything but the
+ * output geometry a rendered frame depends on. Zero disables the
+ * frame cache.
+ */
+static uint64_t frame_seed = 0;
+
+/* Everything a rendered buffer depends on */
+struct buffer_geometry {
+    int width;
+    int height;
+    int scale;
+    int32_t transform;
+};
+
 struct output {
     struct wl_output *wl_output;
     uint32_t wl_name;
@@ -75,6 +132,7 @@ struct output {
     int scale;
     int width;
     int height;
+    int32_t transform;
 
     int render_width;
     int render_height;
@@ -82,125 +140,942 @@ struct output {
     struct wl_surface *surf;
     struct zwlr_layer_surface_v1 *layer;
     bool configured;
+
+    /* For --timings */
+    uint64_t created;
+    bool committed;
+
+    /* Attached buffer; shared by all outputs with the same geometry */
+    struct buffer *buf;
+    struct buffer_geometry buf_geometry;
 };
 static tll(struct output) outputs;
 
 static bool stretch = false;
+static bool progressive = false;
 
-static void
-render_glyphs(struct buffer *buf, int *x, const int *y, pixman_image_t *color,
-              size_t count, const struct fcft_glyph *glyphs[static count],
-              long *kern)
+static struct image_target
+outputs_target(void)
 {
-    for (size_t i = 0; i < count; i++) {
-        const struct fcft_glyph *g = glyphs[i];
-        if (g == NULL)
+    struct image_target target = {.stretch = stretch};
+    bool first = true;
+
+    tll_foreach(outputs, it) {
+        const struct output *output = &it->item;
+        if (!output->configured)
             continue;
 
-        if (kern != NULL)
-            *x += kern[i];
-
-        if (pixman_image_get_format(g->pix) == PIXMAN_a8r8g8b8) {
-            pixman_image_composite32(
-                PIXMAN_OP_OVER, g->pix, NULL, buf->pix, 0, 0, 0, 0,
-                *x + g->x, *y + font->ascent - g->y, g->width, g->height);
-        } else {
-            pixman_image_composite32(
-                PIXMAN_OP_OVER, color, g->pix, buf->pix, 0, 0, 0, 0,
-                *x + g->x, *y + font->ascent - g->y, g->width, g->height);
-        }
+        const int width = output->render_width * output->scale;
+        const int height = output->render_height * output->scale;
+
+        /* Cropping is only possible when all outputs show the same region */
+        target.uniform = first ||
+            (target.uniform && width == target.width && height == target.height);
+        first = false;
 
-        *x += g->advance.x;
+        if (width > target.width)
+            target.width = width;
+        if (height > target.height)
+            target.height = height;
     }
+
+    return target;
 }
 
-static void
-render_chars(const char32_t *text, size_t text_len,
-             struct buffer *buf, int y, pixman_image_t *color)
+/*
+ * image_load(), but with --dir, SVG images are rasterized for
+ * ‘target’ right away; the next image is loaded while the current one
+ * is shown, and the SVG module only holds one. svg_rasterize() does
+ * not use that one, so the main thread and the preload thread never
+ * wait for each other here.
+ */
+static bool
+decode_image(FILE *fp, const char *path, const struct image_target *target,
+             pixman_image_t **image, bool *reduced)
 {
-    const struct fcft_glyph *glyphs[text_len];
-    long kern[text_len];
-    int text_width = 0;
+#if defined(WBG_HAVE_SVG)
+    if (slideshow_dir != NULL && image_probe(fp, path) == IMAGE_FORMAT_SVG) {
+        *reduced = true;
+        return (*image = svg_rasterize(fp, path, target)) != NULL;
+    }
+#endif
 
-    for (size_t i = 0; i < text_len; i++) {
-        glyphs[i] = fcft_rasterize_char_utf32(font, text[i], subpixel_mode);
-        if (glyphs[i] == NULL)
-            continue;
+    return image_load(fp, path, target, image, reduced);
+}
+
+static bool
+load_image(void)
+{
+    const struct image_target target = outputs_target();
+    pixman_image_t *new_image;
+    bool reduced;
 
-        kern[i] = 0;
+    if (!decode_image(image_fp, image_path, &target, &new_image, &reduced))
+        return false;
+
+    if (image != NULL) {
+        free(pixman_image_get_data(image));
+        pixman_image_unref(image);
+    }
+
+    image = new_image;
+    image_target = target;
+    image_reduced = reduced;
+    image_loaded = true;
+
+    /* Cached images were scaled from the previous decode */
+    scale_cache_clear();
+
+    /* Buffers rendered from the previous image, or a preview, must
+     * not be shared with outputs rendered from the new one */
+    tll_foreach(outputs, it) {
+        if (it->item.buf != NULL) {
+            shm_buffer_unref(it->item.buf);
+            it->item.buf = NULL;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * load_image(), for the first image shown. With --dir, images that
+ * fail to load are skipped, as in preload_thread(); this only fails
+ * if none of them loads.
+ */
+static bool
+load_first_image(void)
+{
+    const size_t count = slideshow_dir != NULL ? slideshow_count() : 1;
+    const size_t first = slideshow_idx;
+
+    for (size_t i = 0; i < count; i++) {
         if (i > 0) {
-            long x_kern;
-            if (fcft_kerning(font, text[i - 1], text[i], &x_kern, NULL))
-                kern[i] = x_kern;
+            const size_t idx = (first + i) % count;
+            const char *path = slideshow_path(idx);
+
+            FILE *fp = fopen(path, "rb");
+            if (fp == NULL) {
+                LOG_ERRNO("%s: failed to open", path);
+                continue;
+            }
+
+            fclose(image_fp);
+            image_fp = fp;
+            image_path = path;
+            slideshow_idx = idx;
+
+            /* The frame cache is keyed by the first file's content */
+            frame_seed = 0;
         }
 
-        text_width += kern[i] + glyphs[i]->advance.x;
+        if (load_image())
+            return true;
+
+        if (i + 1 < count)
+            LOG_WARN("%s: failed to load; skipping", image_path);
     }
 
-    int x = (buf->width - text_width) / 2;
-    render_glyphs(buf, &x, &y, color, text_len, glyphs, kern);
+    return false;
 }
 
+/*
+ * The image may have been decoded at a reduced size, or cropped.
+ * Re-decode it if the outputs now need more than that covers.
+ */
 static void
-render(struct output *output)
+reload_image_if_too_small(void)
 {
-    const int width = output->render_width;
-    const int height = output->render_height;
-    const int scale = output->scale;
+    if (image == NULL || !image_reduced)
+        return;
 
-    struct buffer *buf = shm_get_buffer(
-        shm, width * scale, height * scale, (uintptr_t)output);
+    const struct image_target target = outputs_target();
 
-    if (!buf)
+    if (image_target_covers(&image_target, &target))
         return;
 
+    const int width = pixman_image_get_width(image);
+    const int height = pixman_image_get_height(image);
+
+    LOG_INFO("%s: re-loading for %dx%d outputs (decoded at %dx%d)",
+             image_path, target.width, target.height, width, height);
+
+    if (!load_image())
+        LOG_WARN("%s: failed to re-load; using the current image", image_path);
+}
+
+static void render(struct output *output);
+
+/*
+ * Commits the first pass of a progressively decoded image, while the
+ * rest is being decoded. Only done for the initial load; re-loads
+ * keep showing the current image.
+ */
+static void
+image_preview_handler(pixman_image_t *preview, void *data)
+{
+    if (image_loaded)
+        return;
+
+    image = preview;
+    image_is_preview = true;
+
+    tll_foreach(outputs, it) {
+        if (it->item.configured)
+            render(&it->item);
+    }
+
+    wl_display_flush(display);
+
+    image = NULL;
+    image_is_preview = false;
+}
+
+static uint64_t
+frame_key(int width, int height, int scale)
+{
+    const int geometry[] = {width, height, scale};
+    return cache_hash(geometry, sizeof(geometry), frame_seed);
+}
+
+/* True if all configured outputs have a cached frame */
+static bool
+frames_cached(void)
+{
+    if (frame_seed == 0)
+        return false;
+
+    tll_foreach(outputs, it) {
+        const struct output *output = &it->item;
+        if (!output->configured)
+            continue;
+
+        const int width = output->render_width;
+        const int height = output->render_height;
+        const int scale = output->scale;
+
+        if (!frame_cache_contains(
+                frame_key(width, height, scale), width * scale, height * scale))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void font_wait(void);
+
+static void
+render_text(pixman_image_t *pix)
+{
+    if (text_len == 0)
+        return;
+
+    font_wait();
+
+    const int width = pixman_image_get_width(pix);
+    const int height = pixman_image_get_height(pix);
+
+    const uint64_t start = timings_now();
+    pixman_image_t *clr_pix = pixman_image_create_solid_fill(&fg);
+    int y = offset * (height - font->height);
+    text_render(font, subpixel_mode, text, text_len, pix, y, clr_pix);
+    pixman_image_unref(clr_pix);
+    timings_record(start, "text (%dx%d)", width, height);
+}
+
+static void
+render_buffer(struct buffer *buf, int width, int height, int scale)
+{
     pixman_image_t *src = image;
+    const uint64_t start = timings_now();
 
-#if defined(WBG_HAVE_SVG)
-    bool is_svg = false;
-#endif
+    const struct scale_cache_key key = {
+        .width = width,
+        .height = height,
+        .scale = scale,
+        .stretch = stretch,
+    };
 
+    if (image_is_preview)
+        scale_image(src, buf->pix, stretch);
+    else if (!scale_cache_lookup(&key, buf->pix)) {
 #if defined(WBG_HAVE_SVG)
-    if (!src) {
-        src = svg_render(width * scale, height * scale, stretch);
-        is_svg = true;
-    } else
+        if (!src)
+            svg_render(buf->pix, stretch);
+        else
 #endif
+            scale_image(src, buf->pix, stretch);
+
+        scale_cache_insert(&key, buf->pix);
+    }
+
+    timings_record(start, "scale (%dx%d)", width * scale, height * scale);
+    render_text(buf->pix);
+}
+
+static bool
+buffer_geometry_equal(const struct buffer_geometry *a,
+                      const struct buffer_geometry *b)
+{
+    return a->width == b->width &&
+        a->height == b->height &&
+        a->scale == b->scale &&
+        a->transform == b->transform;
+}
+
+/* A frame waiting to be written to the frame cache */
+struct frame_store {
+    uint64_t key;
+    struct buffer *buf;
+    const struct output *output;
+};
+
+/*
+ * Frames are written to the frame cache by a background thread, one
+ * at a time, so that disk I/O and pruning never hold up Wayland event
+ * dispatch. Each frame holds a reference to its buffer until written.
+ * A newer frame for the same output replaces a queued one; of a
+ * configure storm, only the final size is written.
+ */
+static struct {
+    tll(struct frame_store) queue;
+    struct frame_store current;
+    pthread_t thread;
+    bool thread_running;
+    bool active;        /* ‘current’ is being written */
+    int done_fd;        /* Signaled by the thread when written */
+} frame_stores = {.done_fd = -1};
+
+static void *
+frame_store_thread(void *data)
+{
+    const uint64_t start = timings_now();
+    frame_cache_store(frame_stores.current.key, frame_stores.current.buf);
+    timings_record(start, "frame cache store");
+
+    const uint64_t one = 1;
+    if (write(frame_stores.done_fd, &one, sizeof(one)) != sizeof(one))
+        LOG_ERRNO("failed to signal frame cache store completion");
+
+    return NULL;
+}
+
+static void
+frame_store_next(void)
+{
+    if (frame_stores.active || tll_length(frame_stores.queue) == 0)
+        return;
+
+    if (frame_stores.done_fd < 0 &&
+        (frame_stores.done_fd = eventfd(0, EFD_CLOEXEC)) < 0)
     {
-        double sx = (double)(width * scale) / pixman_image_get_width(src);
-        double sy = (double)(height * scale) / pixman_image_get_height(src);
-        double s = stretch ? fmax(sx, sy) : fmin(sx, sy);
+        LOG_ERRNO("failed to create frame cache store FD");
 
-        pixman_transform_t t;
-        pixman_transform_init_scale(&t, pixman_double_to_fixed(1/s), pixman_double_to_fixed(1/s));
-        pixman_transform_translate(&t, NULL,
-            pixman_double_to_fixed((pixman_image_get_width(src) - width * scale / s) / 2),
-            pixman_double_to_fixed((pixman_image_get_height(src) - height * scale / s) / 2));
+        tll_foreach(frame_stores.queue, it) {
+            shm_buffer_unref(it->item.buf);
+            tll_remove(frame_stores.queue, it);
+        }
+        return;
+    }
+
+    frame_stores.current = tll_pop_front(frame_stores.queue);
+    frame_stores.active = true;
 
-        pixman_image_set_transform(src, &t);
-        pixman_image_set_filter(src, PIXMAN_FILTER_BEST, NULL, 0);
+    if (pthread_create(&frame_stores.thread, NULL, &frame_store_thread, NULL) == 0)
+        frame_stores.thread_running = true;
+    else
+        frame_store_thread(NULL);
+}
+
+static void
+frame_store_queue(uint64_t key, struct buffer *buf, const struct output *output)
+{
+    tll_foreach(frame_stores.queue, it) {
+        if (it->item.output == output) {
+            shm_buffer_unref(it->item.buf);
+            tll_remove(frame_stores.queue, it);
+        }
     }
 
-    pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, buf->pix,
-                             0, 0, 0, 0, 0, 0, width * scale, height * scale);
+    shm_buffer_ref(buf);
+    tll_push_back(
+        frame_stores.queue, ((struct frame_store){
+            .key = key, .buf = buf, .output = output}));
 
-    pixman_image_t *clr_pix = pixman_image_create_solid_fill(&fg);
-    int y = offset * (height * scale - font->height);
-    render_chars(text, text_len, buf, y, clr_pix);
+    frame_store_next();
+}
 
-#if defined(WBG_HAVE_SVG)
-    if (is_svg) {
-        free(pixman_image_get_data(src));
-        pixman_image_unref(src);
+/* Called when ‘done_fd’ is signaled */
+static void
+frame_store_finish(void)
+{
+    uint64_t count;
+    if (read(frame_stores.done_fd, &count, sizeof(count)) != sizeof(count))
+        LOG_ERRNO("failed to read from frame cache store FD");
+
+    if (frame_stores.thread_running) {
+        pthread_join(frame_stores.thread, NULL);
+        frame_stores.thread_running = false;
+    }
+
+    shm_buffer_unref(frame_stores.current.buf);
+    frame_stores.active = false;
+
+    frame_store_next();
+}
+
+/* Finishes the frame being written; queued ones are dropped */
+static void
+frame_store_stop(void)
+{
+    if (frame_stores.thread_running) {
+        pthread_join(frame_stores.thread, NULL);
+        frame_stores.thread_running = false;
+    }
+
+    if (frame_stores.active)
+        shm_buffer_unref(frame_stores.current.buf);
+    frame_stores.active = false;
+
+    tll_foreach(frame_stores.queue, it) {
+        shm_buffer_unref(it->item.buf);
+        tll_remove(frame_stores.queue, it);
     }
-#endif
+
+    if (frame_stores.done_fd >= 0)
+        close(frame_stores.done_fd);
+    frame_stores.done_fd = -1;
+}
+
+/* Attaches, and commits, ‘buf’. Takes over the caller's reference */
+static void
+output_attach(struct output *output, struct buffer *buf,
+              const struct buffer_geometry *geometry)
+{
+    if (output->buf != NULL)
+        shm_buffer_unref(output->buf);
+    output->buf = buf;
+    output->buf_geometry = *geometry;
+    buf->busy = true;
+    buf->attached = true;
+
+    const int scale = geometry->scale;
 
     wl_surface_set_buffer_scale(output->surf, scale);
     wl_surface_attach(output->surf, buf->wl_buf, 0, 0);
-    wl_surface_damage_buffer(output->surf, 0, 0, width * scale, height * scale);
+    wl_surface_damage_buffer(
+        output->surf, 0, 0, geometry->width * scale, geometry->height * scale);
     wl_surface_commit(output->surf);
 }
 
+static void
+render(struct output *output)
+{
+    if (!outputs_ready)
+        return;
+
+    const uint64_t start = timings_now();
+
+    if (!image_is_preview)
+        reload_image_if_too_small();
+
+    const int width = output->render_width;
+    const int height = output->render_height;
+    const int scale = output->scale;
+
+    const struct buffer_geometry geometry = {
+        .width = width,
+        .height = height,
+        .scale = scale,
+        .transform = output->transform,
+    };
+
+    struct buffer *buf = NULL;
+
+    /* Re-use the buffer of another output with identical geometry */
+    tll_foreach(outputs, it) {
+        const struct output *other = &it->item;
+
+        if (other == output || other->buf == NULL)
+            continue;
+        if (!buffer_geometry_equal(&other->buf_geometry, &geometry))
+            continue;
+
+        LOG_DBG("%s %s: sharing buffer with %s %s",
+                output->make, output->model, other->make, other->model);
+
+        buf = other->buf;
+        shm_buffer_ref(buf);
+        break;
+    }
+
+    const uint64_t key = frame_key(width, height, scale);
+    bool store_frame = false;
+
+    if (buf == NULL && !image_is_preview && frame_seed != 0) {
+        const uint64_t load_start = timings_now();
+        buf = frame_cache_load(
+            shm, key, width * scale, height * scale, (uintptr_t)output);
+        timings_record(load_start, "frame cache load (%s)",
+                       buf != NULL ? "hit" : "miss");
+    }
+
+    if (buf == NULL) {
+        /* Not decoded at startup, since all outputs had cached frames */
+        if (!image_loaded && !image_is_preview && !load_image()) {
+            LOG_ERR("%s: failed to load", image_path);
+            return;
+        }
+
+        buf = shm_get_buffer(
+            shm, width * scale, height * scale, (uintptr_t)output);
+
+        if (!buf)
+            return;
+
+        render_buffer(buf, width, height, scale);
+        store_frame = !image_is_preview && frame_seed != 0;
+    }
+
+    output_attach(output, buf, &geometry);
+
+    if (!output->committed && !image_is_preview) {
+        timings_record(start, "first commit (%s %s)", output->make, output->model);
+        output->committed = true;
+    }
+
+    if (store_frame)
+        frame_store_queue(key, buf, output);
+}
+
+/*
+ * Upper limit of memory held by a preloaded image, and the frames
+ * rendered from it. The frames are what makes the switch instant, and
+ * are always kept. The decoded image is dropped if it does not fit,
+ * and only decoded again if an output needs a frame that was not
+ * preloaded.
+ */
+#define PRELOAD_MAX_SIZE (256 * 1024 * 1024)
+
+/* A frame of the next image, for all outputs with ‘geometry’ */
+struct preload_frame {
+    struct buffer_geometry geometry;
+    struct buffer *buf;
+};
+
+/*
+ * --dir: while an image is shown, the next one is decoded, and
+ * rendered into a SHM buffer per output geometry, on a background
+ * thread. Switching images is then only an attach, and a commit.
+ *
+ * Buffers are allocated, and attached, on the main thread. The
+ * thread signals ‘done_fd’ when finished; until then, the main thread
+ * leaves everything in here alone.
+ */
+static struct {
+    bool active;          /* Started, ‘done_fd’ not yet signaled */
+    bool done;            /* Finished, not yet switched to */
+    pthread_t thread;
+    bool thread_running;
+    int done_fd;
+
+    struct image_target target;
+    tll(struct preload_frame) frames;
+
+    /* Set by the thread */
+    bool ok;
+    size_t idx;
+    FILE *fp;
+    pixman_image_t *image;  /* NULL if dropped */
+    bool reduced;
+} preload = {.done_fd = -1};
+
+/* The interval expired before the next image was preloaded */
+static bool switch_pending = false;
+static uint64_t switch_due;
+
+static void *
+preload_thread(void *data)
+{
+    const uint64_t start = timings_now();
+    const size_t count = slideshow_count();
+
+    /*
+     * Decode, and scale, on this thread only. Holding the pool would
+     * make a render() on the main thread, for a configure or a
+     * hot-plugged output, wait for all of it.
+     */
+    thread_pool_set_serial();
+
+    /* Skip images that fail to load */
+    for (size_t i = 1; i < count && !preload.ok; i++) {
+        const size_t idx = (slideshow_idx + i) % count;
+        const char *path = slideshow_path(idx);
+
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL) {
+            LOG_ERRNO("%s: failed to open", path);
+            continue;
+        }
+
+        if (!decode_image(fp, path, &preload.target,
+                          &preload.image, &preload.reduced))
+        {
+            LOG_WARN("%s: failed to load; skipping", path);
+            fclose(fp);
+            continue;
+        }
+
+        preload.ok = true;
+        preload.idx = idx;
+        preload.fp = fp;
+    }
+
+    if (preload.ok) {
+        size_t size = 0;
+
+        tll_foreach(preload.frames, it) {
+            struct buffer *buf = it->item.buf;
+            scale_image(preload.image, buf->pix, stretch);
+            render_text(buf->pix);
+            size += buf->size;
+        }
+
+        const size_t image_size =
+            (size_t)pixman_image_get_stride(preload.image) *
+            pixman_image_get_height(preload.image);
+
+        if (size + image_size > PRELOAD_MAX_SIZE) {
+            LOG_DBG("%s: dropping the decoded image (%zu bytes); "
+                    "frames use %zu bytes",
+                    slideshow_path(preload.idx), image_size, size);
+
+            free(pixman_image_get_data(preload.image));
+            pixman_image_unref(preload.image);
+            preload.image = NULL;
+        }
+
+        timings_record(start, "preload (%s)", slideshow_path(preload.idx));
+    }
+
+    const uint64_t one = 1;
+    if (write(preload.done_fd, &one, sizeof(one)) != sizeof(one))
+        LOG_ERRNO("failed to signal preload completion");
+
+    return NULL;
+}
+
+static void
+preload_reset(void)
+{
+    tll_foreach(preload.frames, it) {
+        shm_buffer_unref(it->item.buf);
+        tll_remove(preload.frames, it);
+    }
+
+    if (preload.image != NULL) {
+        free(pixman_image_get_data(preload.image));
+        pixman_image_unref(preload.image);
+    }
+    if (preload.fp != NULL)
+        fclose(preload.fp);
+
+    preload.done = false;
+    preload.ok = false;
+    preload.image = NULL;
+    preload.fp = NULL;
+}
+
+/* Preloads the image after the one being shown */
+static void
+preload_start(void)
+{
+    if (preload.active || slideshow_count() < 2)
+        return;
+
+    preload_reset();
+
+    /* The thread renders text; the font must be loaded by then */
+    if (text_len > 0)
+        font_wait();
+
+    preload.target = outputs_target();
+
+    tll_foreach(outputs, it) {
+        const struct output *output = &it->item;
+        if (!output->configured)
+            continue;
+
+        const struct buffer_geometry geometry = {
+            .width = output->render_width,
+            .height = output->render_height,
+            .scale = output->scale,
+            .transform = output->transform,
+        };
+
+        bool have_frame = false;
+        tll_foreach(preload.frames, frame) {
+            if (buffer_geometry_equal(&frame->item.geometry, &geometry)) {
+                have_frame = true;
+                break;
+            }
+        }
+
+        if (have_frame)
+            continue;
+
+        struct buffer *buf = shm_get_buffer(
+            shm, geometry.width * geometry.scale,
+            geometry.height * geometry.scale, (uintptr_t)output);
+
+        if (buf == NULL)
+            continue;
+
+        tll_push_back(
+            preload.frames, ((struct preload_frame){
+                .geometry = geometry, .buf = buf}));
+    }
+
+    preload.active = true;
+
+    if (pthread_create(&preload.thread, NULL, &preload_thread, NULL) == 0)
+        preload.thread_running = true;
+    else
+        preload_thread(NULL);
+}
+
+/* Called when ‘done_fd’ is signaled */
+static void
+preload_finish(void)
+{
+    uint64_t count;
+    if (read(preload.done_fd, &count, sizeof(count)) != sizeof(count))
+        LOG_ERRNO("failed to read from preload FD");
+
+    if (preload.thread_running) {
+        pthread_join(preload.thread, NULL);
+        preload.thread_running = false;
+    }
+
+    preload.active = false;
+    preload.done = true;
+}
+
+/* Shows the preloaded image. ‘due’ is when the interval expired */
+static void
+slideshow_switch(uint64_t due)
+{
+    switch_pending = false;
+
+    if (!preload.ok) {
+        LOG_WARN("no other image could be loaded; trying again in %lus",
+                 slideshow_interval);
+        preload_reset();
+        return;
+    }
+
+    const uint64_t start = timings_now();
+
+    if (image != NULL) {
+        free(pixman_image_get_data(image));
+        pixman_image_unref(image);
+    }
+    fclose(image_fp);
+
+    image = preload.image;
+    image_fp = preload.fp;
+    image_path = slideshow_path(preload.idx);
+    image_target = preload.target;
+    image_reduced = preload.reduced;
+    image_loaded = image != NULL;
+    slideshow_idx = preload.idx;
+
+    preload.image = NULL;
+    preload.fp = NULL;
+
+    /* The frame cache is only used for the first image */
+    frame_seed = 0;
+    scale_cache_clear();
+
+    /* Buffers of the previous image must not be shared; see render() */
+    tll_foreach(outputs, it) {
+        if (it->item.buf != NULL) {
+            shm_buffer_unref(it->item.buf);
+            it->item.buf = NULL;
+        }
+    }
+
+    size_t switched = 0;
+
+    tll_foreach(outputs, it) {
+        struct output *output = &it->item;
+        if (!output->configured)
+            continue;
+
+        const struct buffer_geometry geometry = {
+            .width = output->render_width,
+            .height = output->render_height,
+            .scale = output->scale,
+            .transform = output->transform,
+        };
+
+        tll_foreach(preload.frames, frame) {
+            if (!buffer_geometry_equal(&frame->item.geometry, &geometry))
+                continue;
+
+            shm_buffer_ref(frame->item.buf);
+            output_attach(output, frame->item.buf, &geometry);
+            switched++;
+            break;
+        }
+    }
+
+    wl_display_flush(display);
+
+    const uint64_t end = timings_now();
+    LOG_INFO("%s: switched %zu outputs in %.3f ms, %.3f ms after the interval expired",
+             image_path, switched, (end - start) / 1000000.,
+             (end - due) / 1000000.);
+
+    /* Outputs configured, or resized, while preloading */
+    tll_foreach(outputs, it) {
+        if (it->item.configured && it->item.buf == NULL)
+            render(&it->item);
+    }
+
+    preload_reset();
+    preload_start();
+}
+
+/* Called when the interval expires */
+static void
+slideshow_timer(void)
+{
+    uint64_t expirations;
+    if (read(slideshow_timer_fd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations))
+    {
+        LOG_ERRNO("failed to read from slideshow timer FD");
+        return;
+    }
+
+    const uint64_t now = timings_now();
+
+    if (preload.done) {
+        slideshow_switch(now);
+        return;
+    }
+
+    /* Previous attempt failed */
+    preload_start();
+
+    if (!switch_pending) {
+        LOG_WARN("%s: not preloaded yet; switching once it is",
+                 slideshow_path(slideshow_idx + 1));
+        switch_pending = true;
+        switch_due = now;
+    }
+}
+
+static bool
+slideshow_start(void)
+{
+    if (slideshow_count() < 2)
+        return true;
+
+    if ((preload.done_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        LOG_ERRNO("failed to create preload FD");
+        return false;
+    }
+
+    if ((slideshow_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+        LOG_ERRNO("failed to create slideshow timer FD");
+        return false;
+    }
+
+    const struct itimerspec interval = {
+        .it_interval = {.tv_sec = slideshow_interval},
+        .it_value = {.tv_sec = slideshow_interval},
+    };
+
+    if (timerfd_settime(slideshow_timer_fd, 0, &interval, NULL) < 0) {
+        LOG_ERRNO("failed to arm slideshow timer");
+        return false;
+    }
+
+    preload_start();
+    return true;
+}
+
+static void
+slideshow_stop(void)
+{
+    if (preload.thread_running) {
+        pthread_join(preload.thread, NULL);
+        preload.thread_running = false;
+    }
+
+    preload_reset();
+
+    if (preload.done_fd >= 0)
+        close(preload.done_fd);
+    if (slideshow_timer_fd >= 0)
+        close(slideshow_timer_fd);
+
+    preload.done_fd = -1;
+    slideshow_timer_fd = -1;
+}
+
+/*
+ * --render-to: renders a single frame, for an output of the given
+ * size, into memory instead of a SHM buffer, and writes it to ‘path’.
+ * No compositor is needed.
+ */
+static bool
+render_to_file(const char *path, int width, int height, int scale)
+{
+    tll_push_back(
+        outputs, ((struct output){
+            .scale = scale,
+            .width = width * scale, .height = height * scale,
+            .render_width = width, .render_height = height,
+            .configured = true}));
+
+    if (!load_first_image()) {
+        LOG_ERR("%s: failed to load", image_path);
+        return false;
+    }
+
+    const int stride = stride_for_format_and_width(
+        PIXMAN_x8r8g8b8, width * scale);
+    void *data = calloc((size_t)height * scale, stride);
+    if (data == NULL)
+        return false;
+
+    struct buffer buf = {
+        .width = width * scale,
+        .height = height * scale,
+        .stride = stride,
+        .size = (size_t)stride * height * scale,
+        .mmapped = data,
+        .fd = -1,
+        .pix = pixman_image_create_bits_no_clear(
+            PIXMAN_x8r8g8b8, width * scale, height * scale, data, stride),
+    };
+
+    render_buffer(&buf, width, height, scale);
+
+    const uint64_t start = timings_now();
+    bool ret = image_write(path, buf.pix);
+    timings_record(start, "write (%s)", path);
+
+    pixman_image_unref(buf.pix);
+    free(data);
+    return ret;
+}
+
 static void
 layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface,
                         uint32_t serial, uint32_t w, uint32_t h)
@@ -219,6 +1094,11 @@ layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface,
         return;
     }
 
+    if (!output->configured) {
+        timings_record(output->created, "first configure (%s %s)",
+                       output->make, output->model);
+    }
+
     output->render_width = w;
     output->render_height = h;
     output->configured = true;
@@ -233,8 +1113,12 @@ output_layer_destroy(struct output *output)
     if (output->surf != NULL)
         wl_surface_destroy(output->surf);
 
+    if (output->buf != NULL)
+        shm_buffer_unref(output->buf);
+
     output->layer = NULL;
     output->surf = NULL;
+    output->buf = NULL;
     output->configured = false;
 }
 
@@ -262,6 +1146,7 @@ static void
 output_destroy(struct output *output)
 {
     output_layer_destroy(output);
+    shm_purge((uintptr_t)output);
 
     if (output->wl_output != NULL)
         wl_output_release(output->wl_output);
@@ -284,6 +1169,7 @@ output_geometry(void *data, struct wl_output *wl_output, int32_t x, int32_t y,
 
     output->make = make != NULL ? strdup(make) : NULL;
     output->model = model != NULL ? strdup(model) : NULL;
+    output->transform = transform;
 }
 
 static void
@@ -372,6 +1258,7 @@ add_surface_to_output(struct output *output)
 
     output->surf = surf;
     output->layer = layer;
+    output->created = timings_now();
 
     zwlr_layer_surface_v1_add_listener(layer, &layer_surface_listener, output);
     wl_surface_commit(surf);
@@ -422,7 +1309,7 @@ handle_global(void *data, struct wl_registry *registry,
         tll_push_back(
             outputs, ((struct output){
                 .wl_output = wl_output, .wl_name = name,
-                .surf = NULL, .layer = NULL}));
+                .surf = NULL, .layer = NULL, .buf = NULL}));
 
         struct output *output = &tll_back(outputs);
         wl_output_add_listener(wl_output, &output_listener, output);
@@ -457,18 +1344,143 @@ static const struct wl_registry_listener registry_listener = {
     .global_remove = &handle_global_remove,
     };
 
+/* Instantiates the font, and fallbacks */
+static void *
+font_load_thread(void *data)
+{
+    const char *font_list = data;
+    const uint64_t start = timings_now();
+    tll(const char *) font_names = tll_init();
+
+    char *copy = strdup(font_list);
+    char *saveptr;
+    for (char *name = strtok_r(copy, ",", &saveptr);
+         name != NULL;
+         name = strtok_r(NULL, ",", &saveptr))
+    {
+        while (isspace(*name))
+            name++;
+
+        size_t len = strlen(name);
+        while (len > 0 && isspace(name[len - 1]))
+            name[--len] = '\0';
+
+        tll_push_back(font_names, name);
+    }
+
+    const char *names[tll_length(font_names)];
+    size_t idx = 0;
+
+    tll_foreach(font_names, it)
+        names[idx++] = it->item;
+
+    font = fcft_from_name(tll_length(font_names), names, NULL);
+    if (font != NULL)
+        fcft_set_emoji_presentation(font, FCFT_EMOJI_PRESENTATION_DEFAULT);
+
+    tll_free(font_names);
+    free(copy);
+    timings_record(start, "font load");
+    return NULL;
+}
+
+static void
+font_wait(void)
+{
+    if (font_thread_running) {
+        pthread_join(font_thread, NULL);
+        font_thread_running = false;
+    }
+
+    assert(font != NULL);
+}
+
+/* See ‘frame_seed’. Returns zero if the image file cannot be read */
+static uint64_t
+frame_cache_seed(const char *font_list)
+{
+    size_t size;
+    const uint8_t *data = image_map_file(image_fp, image_path, &size);
+    if (data == NULL)
+        return 0;
+
+    uint64_t h = cache_hash(WBG_VERSION, strlen(WBG_VERSION), 0);
+    h = cache_hash(data, size, h);
+    image_unmap_file(data, size);
+
+    h = cache_hash(&stretch, sizeof(stretch), h);
+
+    /* Font options are irrelevant without text */
+    if (text_len > 0) {
+        h = cache_hash(text, text_len * sizeof(text[0]), h);
+        h = cache_hash(font_list, strlen(font_list), h);
+        h = cache_hash(&subpixel_mode, sizeof(subpixel_mode), h);
+        h = cache_hash(&fg, sizeof(fg), h);
+        h = cache_hash(&offset, sizeof(offset), h);
+    }
+    return h != 0 ? h : 1;
+}
+
+/* Hashing reads the entire image file; it is in the page cache by
+ * the time the image is decoded */
+static void *
+frame_seed_load_thread(void *data)
+{
+    const uint64_t start = timings_now();
+    frame_seed = frame_cache_seed(data);
+    timings_record(start, "image hash");
+    return NULL;
+}
+
+static void
+frame_seed_wait(void)
+{
+    if (frame_seed_thread_running) {
+        pthread_join(frame_seed_thread, NULL);
+        frame_seed_thread_running = false;
+    }
+}
+
 static void
 usage(const char *progname)
 {
     printf("Usage: %s [OPTIONS] IMAGE_FILE\n"
+           "       %s [OPTIONS] --dir=DIR\n"
            "\n"
            "Options:\n"
            "  -t,--text=TEXT       text string to render\n"
            "  -f,--font=FONTS      comma separated list of FontConfig formatted font specifications\n"
            "  -c,--color=RRGGBBAA  text color (e.g. 00ff00ff for non-transparent green)\n"
            "  -s,--stretch         stretch the image to fill the screen\n"
+           "  -j,--threads=COUNT   number of threads used to scale the image (default: number of CPUs)\n"
+           "  -p,--progressive     show a low resolution pass of progressive (JPEG XL) images while decoding\n"
+           "     --timings         print how long each startup phase took, at exit\n"
+           "     --render-to=FILE  render a single frame to FILE (.png, .pam or .ppm), without a compositor, and exit\n"
+           "     --size=WxH[@N]    output size, and scale, to render for with --render-to\n"
+           "     --dir=DIR         cycle through the images in DIR, in name order\n"
+           "     --interval=SECS   time each image is shown, with --dir (default: 300)\n"
            "  -v,--version         show the version number and quit\n"
-           , progname);
+           , progname, progname);
+}
+
+/* Parses ‘WxH’, or ‘WxH@SCALE’ */
+static bool
+parse_size(const char *s, int *width, int *height, int *scale)
+{
+    int n = -1;
+    *scale = 1;
+
+    if (sscanf(s, "%dx%d%n", width, height, &n) < 2 || n < 0)
+        return false;
+
+    if (s[n] == '@') {
+        int m = -1;
+        if (sscanf(&s[n + 1], "%d%n", scale, &m) < 1 || m < 0)
+            return false;
+        n += 1 + m;
+    }
+
+    return s[n] == '\0' && *width > 0 && *height > 0 && *scale > 0;
 }
 
 static const char *
@@ -497,6 +1509,13 @@ main(int argc, char *const *argv)
         {"color",   required_argument, NULL, 'c'},
         {"offset",  required_argument, NULL, 'o'},
         {"stretch", no_argument, 0, 's'},
+        {"threads", required_argument, NULL, 'j'},
+        {"progressive", no_argument, 0, 'p'},
+        {"timings", no_argument, 0, 'T'},
+        {"render-to", required_argument, NULL, 'R'},
+        {"size",    required_argument, NULL, 'S'},
+        {"dir",     required_argument, NULL, 'D'},
+        {"interval", required_argument, NULL, 'I'},
         {"version", no_argument, 0, 'v'},
         {"help",    no_argument, 0, 'h'},
         {NULL,      no_argument, 0, 0},
@@ -504,9 +1523,12 @@ main(int argc, char *const *argv)
 
     const char *user_text = "";
     const char *font_list = "Sans:size=14";
+    unsigned long thread_count = 0;
+    const char *render_to = NULL;
+    int render_width = 0, render_height = 0, render_scale = 1;
 
     while (true) {
-        int c = getopt_long(argc, argv, ":t:f:c:o:svh", longopts, NULL);
+        int c = getopt_long(argc, argv, ":t:f:c:o:sj:pvh", longopts, NULL);
         if (c < 0)
             break;
 
@@ -557,6 +1579,53 @@ main(int argc, char *const *argv)
             stretch = true;
             break;
 
+        case 'j': {
+            errno = 0;
+            char *end;
+            thread_count = strtoul(optarg, &end, 10);
+
+            if (*end != '\0' || errno != 0 || thread_count == 0) {
+                fprintf(stderr, "error: -j: %s: invalid thread count\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+
+        case 'p':
+            progressive = true;
+            break;
+
+        case 'T':
+            timings_enable();
+            break;
+
+        case 'R':
+            render_to = optarg;
+            break;
+
+        case 'S':
+            if (!parse_size(optarg, &render_width, &render_height, &render_scale)) {
+                fprintf(stderr, "error: --size: %s: invalid size\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'D':
+            slideshow_dir = optarg;
+            break;
+
+        case 'I': {
+            errno = 0;
+            char *end;
+            slideshow_interval = strtoul(optarg, &end, 10);
+
+            if (*end != '\0' || errno != 0 || slideshow_interval == 0) {
+                fprintf(stderr, "error: --interval: %s: invalid interval\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+
         case 'v':
             printf("wbg version: %s\n", version_and_features());
             return EXIT_SUCCESS;
@@ -575,17 +1644,31 @@ main(int argc, char *const *argv)
         }
     }
 
-    const char *image_path = argv[argc - 1];
+    if (render_to != NULL && render_width == 0) {
+        fprintf(stderr, "error: --render-to: requires --size\n");
+        return EXIT_FAILURE;
+    }
+
+    if (slideshow_dir != NULL && optind < argc) {
+        fprintf(stderr, "error: --dir: cannot be combined with an image file\n");
+        return EXIT_FAILURE;
+    }
+
+    image_path = argv[argc - 1];
 
     setlocale(LC_CTYPE, "");
     log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_DAEMON, LOG_CLASS_WARNING);
 
     LOG_INFO("%s", WBG_VERSION);
 
-    assert(locale_is_utf8());
-    fcft_init(FCFT_LOG_COLORIZE_AUTO, false, FCFT_LOG_CLASS_DEBUG);
-    atexit(&fcft_fini);
+    if (slideshow_dir != NULL) {
+        if (!slideshow_init(slideshow_dir))
+            return EXIT_FAILURE;
+        atexit(&slideshow_fini);
+        image_path = slideshow_path(0);
+    }
 
+    assert(locale_is_utf8());
     /* Convert text string to Unicode */
     text = calloc(strlen(user_text) + 1, sizeof(text[0]));
     assert(text != NULL);
@@ -614,78 +1697,78 @@ main(int argc, char *const *argv)
         }
     }
 
-    /* Instantiate font, and fallbacks */
-    {
-        tll(const char *) font_names = tll_init();
-
-        char *copy = strdup(font_list);
-        for (char *name = strtok(copy, ",");
-             name != NULL;
-             name = strtok(NULL, ","))
-        {
-            while (isspace(*name))
-                name++;
-
-            size_t len = strlen(name);
-            while (len > 0 && isspace(name[len - 1]))
-                name[--len] = '\0';
-
-            tll_push_back(font_names, name);
-        }
-
-        const char *names[tll_length(font_names)];
-        size_t idx = 0;
-
-        tll_foreach(font_names, it)
-            names[idx++] = it->item;
+    image = NULL;
+    scale_cache_init(SCALE_CACHE_MAX_SIZE);
+
+    /*
+     * Signals are read from a signalfd, in the main loop. Block them
+     * before any threads are started, so that all of them inherit
+     * the mask; a signal arriving during startup is then handled
+     * once the main loop runs, instead of killing us.
+     */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGTERM);
 
-        font = fcft_from_name(tll_length(font_names), names, NULL);
-        assert(font != NULL);
-        fcft_set_emoji_presentation(font, FCFT_EMOJI_PRESENTATION_DEFAULT);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
 
-        tll_free(font_names);
-        free(copy);
-    }
+    if (!thread_pool_init(thread_count))
+        return EXIT_FAILURE;
+    atexit(&thread_pool_fini);
 
-    image = NULL;
+    uint64_t start = timings_now();
+    image_fp = fopen(image_path, "rb");
+    timings_record(start, "file open");
 
-    FILE *fp = fopen(image_path, "rb");
-    if (fp == NULL) {
+    if (image_fp == NULL) {
         LOG_ERRNO("%s: failed to open", image_path);
         fprintf(stderr, "\nUsage: %s [-s|--stretch] <image_path>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-#if defined(WBG_HAVE_JPG)
-    if (image == NULL)
-        image = jpg_load(fp, image_path);
-#endif
-#if defined(WBG_HAVE_PNG)
-    if (image == NULL)
-        image = png_load(fp, image_path);
-#endif
-#if defined(WBG_HAVE_WEBP)
-    if (image == NULL)
-        image = webp_load(fp, image_path);
-#endif
-#if defined(WBG_HAVE_JXL)
-    if (image == NULL)
-        image = jxl_load(fp, image_path);
-#endif
-    if (image == NULL
-#if defined(WBG_HAVE_SVG)
-        && !svg_load(fp, image_path)
-#endif
-    ) {
-        LOG_ERR("%s: failed to load", image_path);
-        fclose(fp);
-        return EXIT_FAILURE;
+    /*
+     * Fonts are only needed to render text; don't initialize
+     * fontconfig and FreeType without any. The font is loaded while
+     * we connect to the compositor, and decode the image.
+     */
+    if (text_len > 0) {
+        start = timings_now();
+        fcft_init(FCFT_LOG_COLORIZE_AUTO, false, FCFT_LOG_CLASS_DEBUG);
+        atexit(&fcft_fini);
+        timings_record(start, "fcft init");
+
+        if (pthread_create(&font_thread, NULL, &font_load_thread,
+                           (void *)font_list) == 0)
+            font_thread_running = true;
+        else
+            font_load_thread((void *)font_list);
     }
 
     int exit_code = EXIT_FAILURE;
     int sig_fd = -1;
 
+    /* Renders with the same code as below, but without the frame cache */
+    if (render_to != NULL) {
+        /* There is no main loop; let signals terminate us */
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+        if (render_to_file(render_to, render_width, render_height, render_scale))
+            exit_code = EXIT_SUCCESS;
+        goto out;
+    }
+
+    if (pthread_create(&frame_seed_thread, NULL, &frame_seed_load_thread,
+                       (void *)font_list) == 0)
+        frame_seed_thread_running = true;
+    else
+        frame_seed_load_thread((void *)font_list);
+
+    start = timings_now();
     display = wl_display_connect(NULL);
+    timings_record(start, "wayland connect");
+
     if (display == NULL) {
         LOG_ERR("failed to connect to wayland; no compositor running?");
         goto out;
@@ -698,7 +1781,10 @@ main(int argc, char *const *argv)
     }
 
     wl_registry_add_listener(registry, &registry_listener, NULL);
+
+    start = timings_now();
     wl_display_roundtrip(display);
+    timings_record(start, "roundtrip (registry)");
 
     if (compositor == NULL) {
         LOG_ERR("no compositor");
@@ -716,19 +1802,43 @@ main(int argc, char *const *argv)
     tll_foreach(outputs, it)
         add_surface_to_output(&it->item);
 
+    start = timings_now();
     wl_display_roundtrip(display);
+    timings_record(start, "roundtrip (configure)");
 
     if (!have_xrgb8888) {
         LOG_ERR("shm: XRGB image format not available");
         goto out;
     }
 
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGINT);
-    sigaddset(&mask, SIGQUIT);
+    /*
+     * Outputs have been configured; decode for their sizes, and
+     * render. If all of them have a cached frame, the image is only
+     * decoded if an output with a new size shows up.
+     */
+    outputs_ready = true;
+    frame_seed_wait();
+
+    if (!frames_cached()) {
+        if (progressive)
+            image_set_preview_handler(&image_preview_handler, NULL);
+
+        if (!load_first_image()) {
+            LOG_ERR("%s: failed to load", image_path);
+            goto out;
+        }
 
-    sigprocmask(SIG_BLOCK, &mask, NULL);
+        image_set_preview_handler(NULL, NULL);
+    }
+
+    tll_foreach(outputs, it) {
+        if (it->item.configured)
+            render(&it->item);
+    }
+
+    /* --dir: preloads the second image */
+    if (!slideshow_start())
+        goto out;
 
     if ((sig_fd = signalfd(-1, &mask, 0)) < 0) {
         LOG_ERRNO("failed to create signal FD");
@@ -741,6 +1851,9 @@ main(int argc, char *const *argv)
         struct pollfd fds[] = {
             {.fd = wl_display_get_fd(display), .events = POLLIN},
             {.fd = sig_fd, .events = POLLIN},
+            {.fd = slideshow_timer_fd, .events = POLLIN},
+            {.fd = preload.done_fd, .events = POLLIN},
+            {.fd = frame_stores.done_fd, .events = POLLIN},
         };
         int ret = poll(fds, sizeof(fds) / sizeof(fds[0]), -1);
 
@@ -779,12 +1892,26 @@ main(int argc, char *const *argv)
             }
 
             assert(count == sizeof(info));
-            assert(info.ssi_signo == SIGINT || info.ssi_signo == SIGQUIT);
+            assert(info.ssi_signo == SIGINT ||
+                   info.ssi_signo == SIGQUIT ||
+                   info.ssi_signo == SIGTERM);
 
             LOG_INFO("goodbye");
             exit_code = EXIT_SUCCESS;
             break;
         }
+
+        if (fds[3].revents & POLLIN) {
+            preload_finish();
+            if (switch_pending)
+                slideshow_switch(switch_due);
+        }
+
+        if (fds[2].revents & POLLIN)
+            slideshow_timer();
+
+        if (fds[4].revents & POLLIN)
+            frame_store_finish();
     }
 
 out:
@@ -792,9 +1919,18 @@ out:
     if (sig_fd >= 0)
         close(sig_fd);
 
+    frame_seed_wait();
+    if (font_thread_running)
+        pthread_join(font_thread, NULL);
+    slideshow_stop();
+    frame_store_stop();
+
+    timings_report();
+
     tll_foreach(outputs, it)
         output_destroy(&it->item);
     tll_free(outputs);
+    shm_fini();
 
     if (layer_shell != NULL)
         zwlr_layer_shell_v1_destroy(layer_shell);
@@ -810,10 +1946,11 @@ out:
         free(pixman_image_get_data(image));
         pixman_image_unref(image);
     }
+    scale_cache_fini();
 #if defined(WBG_HAVE_SVG)
     svg_free();
 #endif
     log_deinit();
-    fclose(fp);
+    fclose(image_fp);
     return exit_code;
 }
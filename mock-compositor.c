@@ -0,0 +1,1464 @@
+/*
+ * wbg-mock-compositor: a minimal Wayland server, for testing wbg
+ * without a real compositor.
+ *
+ * Implements just enough of wl_compositor, wl_shm, wl_output and
+ * zwlr_layer_shell_v1 to drive wbg: it announces a set of outputs,
+ * runs wbg against them, and then optionally sends configure storms,
+ * hot-plugs outputs, and runs wbg as a slideshow. It records the time
+ * from each configure event to the wl_surface.commit of a matching
+ * buffer, and the SHM memory allocated, and verifies the committed
+ * pixels.
+ *
+ * Exits with 0 if wbg behaved, and 1 if not.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <wayland-server.h>
+#include <wlr-layer-shell-unstable-v1-server.h>
+
+#define LOG_MODULE "mock-compositor"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+#define MAX_OUTPUTS 16
+
+/* The test image is a single color; see write_test_image() */
+#define TEST_COLOR 0x336699
+
+/* --slideshow: the color of the second image, shown after the test image */
+#define SLIDE_COLOR 0x996633
+
+/* --slideshow: time allowed for each switch; the interval is one second */
+#define SLIDE_SWITCH_MS 1500
+
+struct output {
+    char name[32];
+    int width;   /* Pixels */
+    int height;
+    int scale;
+
+    struct wl_global *global;
+    bool removed;
+
+    /* Time from the first configure, to the first matching commit */
+    double first_commit_ms;
+};
+
+struct pool {
+    int fd;
+    int32_t size;
+    void *map;
+    size_t map_size;
+    int refcount;  /* The wl_shm_pool, and each of its buffers */
+};
+
+struct buffer {
+    struct pool *pool;
+    int32_t offset;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+    uint32_t format;
+
+    /* Number of surfaces showing the buffer; released when it drops to 0 */
+    int users;
+};
+
+struct surface {
+    struct wl_resource *resource;
+    struct wl_resource *layer;
+    struct output *output;
+
+    struct wl_resource *pending;
+    struct wl_listener pending_destroy;
+    bool attached;
+    int32_t pending_scale;
+
+    struct wl_resource *current;
+    struct wl_listener current_destroy;
+    int32_t scale;
+
+    bool initial_commit;
+
+    /* Last configure sent, and whether it is still waiting for a buffer */
+    uint32_t configure_serial;
+    uint32_t acked_serial;
+    uint32_t configure_width;
+    uint32_t configure_height;
+    uint64_t configured_at;
+    bool awaiting;
+    bool first;
+
+    /* Center pixel of the last committed buffer */
+    uint32_t color;
+
+    struct wl_list link;
+};
+
+static struct wl_display *display;
+static struct wl_event_loop *loop;
+
+static struct output outputs[MAX_OUTPUTS];
+static size_t output_count = 0;
+static struct wl_list surfaces;
+
+static pid_t child = -1;
+static int child_status;
+
+static char tmp_dir[PATH_MAX];
+static int timeout_ms = 10000;
+
+/* Running a --slideshow; the second image's color is valid too */
+static bool slideshow_colors = false;
+
+/* Statistics */
+static size_t commit_count = 0;
+static size_t configure_count = 0;
+static size_t buffer_count = 0;
+static uint64_t shm_allocated = 0;
+static int64_t shm_live = 0;
+static int64_t shm_peak = 0;
+
+static double *latencies = NULL;
+static size_t latency_count = 0;
+static size_t latency_allocated = 0;
+
+static size_t failures = 0;
+
+#define FAIL(fmt, ...)                                  \
+    do {                                                \
+        LOG_ERR(fmt, ## __VA_ARGS__);                   \
+        failures++;                                     \
+    } while (0)
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+latency_add(double ms)
+{
+    if (latency_count == latency_allocated) {
+        size_t new_allocated = latency_allocated > 0 ? latency_allocated * 2 : 64;
+        double *new_latencies = realloc(
+            latencies, new_allocated * sizeof(latencies[0]));
+
+        if (new_latencies == NULL)
+            return;
+
+        latencies = new_latencies;
+        latency_allocated = new_allocated;
+    }
+
+    latencies[latency_count++] = ms;
+}
+
+static void
+shm_account(int64_t bytes)
+{
+    shm_live += bytes;
+    if (bytes > 0)
+        shm_allocated += bytes;
+    if (shm_live > shm_peak)
+        shm_peak = shm_live;
+}
+
+static void
+resource_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+/*
+ * wl_shm
+ */
+
+static void
+pool_unref(struct pool *pool)
+{
+    if (--pool->refcount > 0)
+        return;
+
+    if (pool->map != NULL)
+        munmap(pool->map, pool->map_size);
+    close(pool->fd);
+    shm_account(-(int64_t)pool->size);
+    free(pool);
+}
+
+/* Maps, or re-maps after a resize, the entire pool */
+static const uint8_t *
+pool_data(struct pool *pool)
+{
+    if (pool->map != NULL && pool->map_size == (size_t)pool->size)
+        return pool->map;
+
+    if (pool->map != NULL)
+        munmap(pool->map, pool->map_size);
+
+    pool->map_size = pool->size;
+    pool->map = mmap(NULL, pool->map_size, PROT_READ, MAP_SHARED, pool->fd, 0);
+
+    if (pool->map == MAP_FAILED) {
+        LOG_ERRNO("failed to map SHM pool");
+        pool->map = NULL;
+    }
+
+    return pool->map;
+}
+
+static void
+buffer_handle_resource_destroy(struct wl_resource *resource)
+{
+    struct buffer *buf = wl_resource_get_user_data(resource);
+    pool_unref(buf->pool);
+    free(buf);
+}
+
+static const struct wl_buffer_interface buffer_impl = {
+    .destroy = &resource_destroy,
+};
+
+static void
+pool_create_buffer(struct wl_client *client, struct wl_resource *resource,
+                   uint32_t id, int32_t offset, int32_t width, int32_t height,
+                   int32_t stride, uint32_t format)
+{
+    struct pool *pool = wl_resource_get_user_data(resource);
+
+    if (format != WL_SHM_FORMAT_XRGB8888 && format != WL_SHM_FORMAT_ARGB8888) {
+        FAIL("invalid SHM format: 0x%08x", format);
+        wl_resource_post_error(
+            resource, WL_SHM_ERROR_INVALID_FORMAT, "invalid format");
+        return;
+    }
+
+    if (offset < 0 || width <= 0 || height <= 0 || stride < width * 4 ||
+        (int64_t)offset + (int64_t)stride * height > pool->size)
+    {
+        FAIL("invalid SHM buffer: %dx%d, stride=%d, offset=%d, pool=%d",
+             width, height, stride, offset, pool->size);
+        wl_resource_post_error(
+            resource, WL_SHM_ERROR_INVALID_STRIDE, "invalid buffer geometry");
+        return;
+    }
+
+    struct buffer *buf = calloc(1, sizeof(*buf));
+    struct wl_resource *buf_resource = wl_resource_create(
+        client, &wl_buffer_interface, 1, id);
+
+    if (buf == NULL || buf_resource == NULL) {
+        free(buf);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    *buf = (struct buffer){
+        .pool = pool,
+        .offset = offset,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .format = format,
+    };
+
+    pool->refcount++;
+    buffer_count++;
+
+    wl_resource_set_implementation(
+        buf_resource, &buffer_impl, buf, &buffer_handle_resource_destroy);
+}
+
+static void
+pool_resize(struct wl_client *client, struct wl_resource *resource, int32_t size)
+{
+    struct pool *pool = wl_resource_get_user_data(resource);
+
+    if (size < pool->size) {
+        wl_resource_post_error(
+            resource, WL_SHM_ERROR_INVALID_FD, "pools can not shrink");
+        return;
+    }
+
+    shm_account(size - pool->size);
+    pool->size = size;
+}
+
+static void
+pool_handle_resource_destroy(struct wl_resource *resource)
+{
+    pool_unref(wl_resource_get_user_data(resource));
+}
+
+static const struct wl_shm_pool_interface pool_impl = {
+    .create_buffer = &pool_create_buffer,
+    .destroy = &resource_destroy,
+    .resize = &pool_resize,
+};
+
+static void
+shm_create_pool(struct wl_client *client, struct wl_resource *resource,
+                uint32_t id, int32_t fd, int32_t size)
+{
+    struct pool *pool = calloc(1, sizeof(*pool));
+    struct wl_resource *pool_resource = wl_resource_create(
+        client, &wl_shm_pool_interface, 1, id);
+
+    if (pool == NULL || pool_resource == NULL) {
+        free(pool);
+        close(fd);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    *pool = (struct pool){.fd = fd, .size = size, .refcount = 1};
+    shm_account(size);
+
+    wl_resource_set_implementation(
+        pool_resource, &pool_impl, pool, &pool_handle_resource_destroy);
+}
+
+static const struct wl_shm_interface shm_impl = {
+    .create_pool = &shm_create_pool,
+};
+
+static void
+shm_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(
+        client, &wl_shm_interface, version, id);
+
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &shm_impl, NULL, NULL);
+    wl_shm_send_format(resource, WL_SHM_FORMAT_ARGB8888);
+    wl_shm_send_format(resource, WL_SHM_FORMAT_XRGB8888);
+}
+
+/*
+ * wl_output
+ */
+
+static const struct wl_output_interface output_impl = {
+    .release = &resource_destroy,
+};
+
+static void
+output_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct output *output = data;
+    struct wl_resource *resource = wl_resource_create(
+        client, &wl_output_interface, version, id);
+
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &output_impl, output, NULL);
+
+    wl_output_send_geometry(
+        resource, 0, 0, 600, 340, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+        "wbg", output->name, WL_OUTPUT_TRANSFORM_NORMAL);
+    wl_output_send_mode(
+        resource, WL_OUTPUT_MODE_CURRENT, output->width, output->height, 60000);
+
+    if (version >= WL_OUTPUT_SCALE_SINCE_VERSION)
+        wl_output_send_scale(resource, output->scale);
+    if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+        wl_output_send_done(resource);
+}
+
+static void
+output_add(struct output *output)
+{
+    output->removed = false;
+    output->first_commit_ms = -1;
+    output->global = wl_global_create(
+        display, &wl_output_interface, 3, output, &output_bind);
+}
+
+/*
+ * wl_surface, and wl_region
+ */
+
+static void
+surface_pending_destroyed(struct wl_listener *listener, void *data)
+{
+    struct surface *surf = wl_container_of(listener, surf, pending_destroy);
+    wl_list_remove(&listener->link);
+    surf->pending = NULL;
+}
+
+static void
+surface_current_destroyed(struct wl_listener *listener, void *data)
+{
+    struct surface *surf = wl_container_of(listener, surf, current_destroy);
+    wl_list_remove(&listener->link);
+    surf->current = NULL;
+}
+
+static void
+surface_set_pending(struct surface *surf, struct wl_resource *buffer)
+{
+    if (surf->pending != NULL)
+        wl_list_remove(&surf->pending_destroy.link);
+
+    surf->pending = buffer;
+    if (buffer != NULL)
+        wl_resource_add_destroy_listener(buffer, &surf->pending_destroy);
+}
+
+/* Makes ‘buffer’ the shown buffer, and releases the previous one */
+static void
+surface_set_current(struct surface *surf, struct wl_resource *buffer)
+{
+    struct wl_resource *old = surf->current;
+
+    if (old != NULL)
+        wl_list_remove(&surf->current_destroy.link);
+
+    surf->current = buffer;
+    if (buffer != NULL) {
+        struct buffer *buf = wl_resource_get_user_data(buffer);
+        buf->users++;
+        wl_resource_add_destroy_listener(buffer, &surf->current_destroy);
+    }
+
+    if (old != NULL) {
+        struct buffer *buf = wl_resource_get_user_data(old);
+        if (--buf->users == 0)
+            wl_buffer_send_release(old);
+    }
+}
+
+static void
+surface_configure(struct surface *surf, uint32_t width, uint32_t height)
+{
+    surf->configure_serial = wl_display_next_serial(display);
+    surf->configure_width = width;
+    surf->configure_height = height;
+    surf->configured_at = now_ns();
+    surf->awaiting = true;
+
+    zwlr_layer_surface_v1_send_configure(
+        surf->layer, surf->configure_serial, width, height);
+    configure_count++;
+}
+
+static void
+surface_configure_output_size(struct surface *surf)
+{
+    const struct output *output = surf->output;
+    surface_configure(
+        surf, output->width / output->scale, output->height / output->scale);
+}
+
+/* Checks the committed buffer; runs on each commit with a new buffer */
+static void
+surface_verify(struct surface *surf, const struct buffer *buf)
+{
+    const struct output *output = surf->output;
+
+    if (surf->scale != output->scale) {
+        FAIL("%s: buffer scale is %d, output scale is %d",
+             output->name, surf->scale, output->scale);
+    }
+
+    /* Center pixel; the test image is centered, and covers it */
+    const uint8_t *data = pool_data(buf->pool);
+    if (data != NULL) {
+        const uint32_t *row = (const uint32_t *)
+            &data[buf->offset + (size_t)buf->stride * (buf->height / 2)];
+        const uint32_t pixel = row[buf->width / 2] & 0xffffff;
+
+        if (pixel != TEST_COLOR && !(slideshow_colors && pixel == SLIDE_COLOR)) {
+            FAIL("%s: %dx%d buffer: center pixel is 0x%06x, expected 0x%06x",
+                 output->name, buf->width, buf->height, pixel, TEST_COLOR);
+        }
+
+        surf->color = pixel;
+    }
+}
+
+static void
+surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+    struct surface *surf = wl_resource_get_user_data(resource);
+    surf->scale = surf->pending_scale;
+
+    if (surf->layer == NULL || surf->output == NULL)
+        return;
+
+    /* The initial commit, without a buffer, asks for a configure */
+    if (!surf->initial_commit) {
+        surf->initial_commit = true;
+        surf->first = true;
+        surface_configure_output_size(surf);
+        return;
+    }
+
+    if (!surf->attached)
+        return;
+
+    surf->attached = false;
+    struct wl_resource *buffer = surf->pending;
+    surface_set_pending(surf, NULL);
+    surface_set_current(surf, buffer);
+
+    if (buffer == NULL)
+        return;
+
+    const uint64_t now = now_ns();
+    const struct buffer *buf = wl_resource_get_user_data(buffer);
+    struct output *output = surf->output;
+
+    commit_count++;
+    surface_verify(surf, buf);
+
+    if (surf->awaiting &&
+        surf->acked_serial == surf->configure_serial &&
+        buf->width == (int32_t)surf->configure_width * output->scale &&
+        buf->height == (int32_t)surf->configure_height * output->scale)
+    {
+        const double ms = (now - surf->configured_at) / 1e6;
+        surf->awaiting = false;
+
+        if (surf->first) {
+            surf->first = false;
+            output->first_commit_ms = ms;
+        } else
+            latency_add(ms);
+
+        LOG_DBG("%s: %dx%d committed %.3f ms after configure",
+                output->name, buf->width, buf->height, ms);
+    }
+}
+
+static void
+surface_attach(struct wl_client *client, struct wl_resource *resource,
+               struct wl_resource *buffer, int32_t x, int32_t y)
+{
+    struct surface *surf = wl_resource_get_user_data(resource);
+    surface_set_pending(surf, buffer);
+    surf->attached = true;
+}
+
+static void
+surface_damage(struct wl_client *client, struct wl_resource *resource,
+               int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+surface_frame(struct wl_client *client, struct wl_resource *resource,
+              uint32_t callback)
+{
+    /* Nothing is ever drawn; done right away */
+    struct wl_resource *cb = wl_resource_create(
+        client, &wl_callback_interface, 1, callback);
+
+    if (cb == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_callback_send_done(cb, (uint32_t)(now_ns() / 1000000));
+    wl_resource_destroy(cb);
+}
+
+static void
+surface_set_region(struct wl_client *client, struct wl_resource *resource,
+                   struct wl_resource *region)
+{
+}
+
+static void
+surface_set_buffer_transform(struct wl_client *client,
+                             struct wl_resource *resource, int32_t transform)
+{
+}
+
+static void
+surface_set_buffer_scale(struct wl_client *client,
+                         struct wl_resource *resource, int32_t scale)
+{
+    struct surface *surf = wl_resource_get_user_data(resource);
+    surf->pending_scale = scale;
+}
+
+static const struct wl_surface_interface surface_impl = {
+    .destroy = &resource_destroy,
+    .attach = &surface_attach,
+    .damage = &surface_damage,
+    .frame = &surface_frame,
+    .set_opaque_region = &surface_set_region,
+    .set_input_region = &surface_set_region,
+    .commit = &surface_commit,
+    .set_buffer_transform = &surface_set_buffer_transform,
+    .set_buffer_scale = &surface_set_buffer_scale,
+    .damage_buffer = &surface_damage,
+};
+
+static void
+surface_handle_resource_destroy(struct wl_resource *resource)
+{
+    struct surface *surf = wl_resource_get_user_data(resource);
+
+    if (surf->layer != NULL)
+        wl_resource_set_user_data(surf->layer, NULL);
+
+    surface_set_pending(surf, NULL);
+    surface_set_current(surf, NULL);
+
+    wl_list_remove(&surf->link);
+    free(surf);
+}
+
+static void
+region_op(struct wl_client *client, struct wl_resource *resource,
+          int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface region_impl = {
+    .destroy = &resource_destroy,
+    .add = &region_op,
+    .subtract = &region_op,
+};
+
+static void
+compositor_create_surface(struct wl_client *client,
+                          struct wl_resource *resource, uint32_t id)
+{
+    struct surface *surf = calloc(1, sizeof(*surf));
+    struct wl_resource *surf_resource = wl_resource_create(
+        client, &wl_surface_interface, wl_resource_get_version(resource), id);
+
+    if (surf == NULL || surf_resource == NULL) {
+        free(surf);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    surf->resource = surf_resource;
+    surf->pending_scale = surf->scale = 1;
+    surf->pending_destroy.notify = &surface_pending_destroyed;
+    surf->current_destroy.notify = &surface_current_destroyed;
+    wl_list_insert(&surfaces, &surf->link);
+
+    wl_resource_set_implementation(
+        surf_resource, &surface_impl, surf, &surface_handle_resource_destroy);
+}
+
+static void
+compositor_create_region(struct wl_client *client,
+                         struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *region = wl_resource_create(
+        client, &wl_region_interface, 1, id);
+
+    if (region == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+    .create_surface = &compositor_create_surface,
+    .create_region = &compositor_create_region,
+};
+
+static void
+compositor_bind(struct wl_client *client, void *data, uint32_t version,
+                uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(
+        client, &wl_compositor_interface, version, id);
+
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &compositor_impl, NULL, NULL);
+}
+
+/*
+ * zwlr_layer_shell_v1
+ */
+
+static void
+layer_surface_set_size(struct wl_client *client, struct wl_resource *resource,
+                       uint32_t width, uint32_t height)
+{
+}
+
+static void
+layer_surface_set_uint(struct wl_client *client, struct wl_resource *resource,
+                       uint32_t value)
+{
+}
+
+static void
+layer_surface_set_exclusive_zone(struct wl_client *client,
+                                 struct wl_resource *resource, int32_t zone)
+{
+}
+
+static void
+layer_surface_set_margin(struct wl_client *client, struct wl_resource *resource,
+                         int32_t top, int32_t right, int32_t bottom, int32_t left)
+{
+}
+
+static void
+layer_surface_get_popup(struct wl_client *client, struct wl_resource *resource,
+                        struct wl_resource *popup)
+{
+}
+
+static void
+layer_surface_ack_configure(struct wl_client *client,
+                            struct wl_resource *resource, uint32_t serial)
+{
+    struct surface *surf = wl_resource_get_user_data(resource);
+    if (surf != NULL)
+        surf->acked_serial = serial;
+}
+
+static const struct zwlr_layer_surface_v1_interface layer_surface_impl = {
+    .set_size = &layer_surface_set_size,
+    .set_anchor = &layer_surface_set_uint,
+    .set_exclusive_zone = &layer_surface_set_exclusive_zone,
+    .set_margin = &layer_surface_set_margin,
+    .set_keyboard_interactivity = &layer_surface_set_uint,
+    .get_popup = &layer_surface_get_popup,
+    .ack_configure = &layer_surface_ack_configure,
+    .destroy = &resource_destroy,
+    .set_layer = &layer_surface_set_uint,
+};
+
+static void
+layer_surface_handle_resource_destroy(struct wl_resource *resource)
+{
+    struct surface *surf = wl_resource_get_user_data(resource);
+    if (surf == NULL)
+        return;
+
+    surf->layer = NULL;
+    surf->output = NULL;
+    surf->awaiting = false;
+}
+
+static void
+layer_shell_get_layer_surface(struct wl_client *client,
+                              struct wl_resource *resource, uint32_t id,
+                              struct wl_resource *surface,
+                              struct wl_resource *output, uint32_t layer,
+                              const char *namespace)
+{
+    struct surface *surf = wl_resource_get_user_data(surface);
+    struct wl_resource *layer_resource = wl_resource_create(
+        client, &zwlr_layer_surface_v1_interface,
+        wl_resource_get_version(resource), id);
+
+    if (layer_resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    if (output == NULL)
+        FAIL("layer surface without an output");
+    if (layer != ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND)
+        FAIL("layer surface not in the background layer: %u", layer);
+
+    surf->layer = layer_resource;
+    surf->output = output != NULL ? wl_resource_get_user_data(output) : NULL;
+
+    wl_resource_set_implementation(
+        layer_resource, &layer_surface_impl, surf,
+        &layer_surface_handle_resource_destroy);
+}
+
+static const struct zwlr_layer_shell_v1_interface layer_shell_impl = {
+    .get_layer_surface = &layer_shell_get_layer_surface,
+    .destroy = &resource_destroy,
+};
+
+static void
+layer_shell_bind(struct wl_client *client, void *data, uint32_t version,
+                 uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(
+        client, &zwlr_layer_shell_v1_interface, version, id);
+
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &layer_shell_impl, NULL, NULL);
+}
+
+/*
+ * Test driver
+ */
+
+static bool
+child_running(void)
+{
+    if (child < 0)
+        return false;
+
+    if (waitpid(child, &child_status, WNOHANG) == child) {
+        child = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/* Dispatches requests until ‘done()’ returns true, for at most ‘ms’ */
+static bool
+run_until_within(bool (*done)(void), const char *what, int ms)
+{
+    const uint64_t deadline = now_ns() + (uint64_t)ms * 1000000;
+
+    while (true) {
+        wl_display_flush_clients(display);
+
+        if (done())
+            return true;
+
+        if (!child_running()) {
+            FAIL("wbg exited while waiting for %s", what);
+            return false;
+        }
+
+        if (now_ns() >= deadline) {
+            FAIL("timeout waiting for %s", what);
+            return false;
+        }
+
+        wl_event_loop_dispatch(loop, 10);
+    }
+}
+
+static bool
+run_until(bool (*done)(void), const char *what)
+{
+    return run_until_within(done, what, timeout_ms);
+}
+
+/* Dispatches requests for ‘ms’ milliseconds */
+static void
+run_for(int ms)
+{
+    const uint64_t deadline = now_ns() + (uint64_t)ms * 1000000;
+
+    while (now_ns() < deadline && child_running()) {
+        wl_display_flush_clients(display);
+        wl_event_loop_dispatch(loop, 10);
+    }
+}
+
+static bool
+surface_shown(const struct surface *surf)
+{
+    return surf->initial_commit && !surf->awaiting && surf->current != NULL;
+}
+
+/* All present outputs show a buffer of the last configured size */
+static bool
+outputs_shown(void)
+{
+    for (size_t i = 0; i < output_count; i++) {
+        const struct output *output = &outputs[i];
+        if (output->removed)
+            continue;
+
+        bool shown = false;
+        struct surface *surf;
+        wl_list_for_each(surf, &surfaces, link) {
+            if (surf->output == output && surface_shown(surf))
+                shown = true;
+        }
+
+        if (!shown)
+            return false;
+    }
+
+    return true;
+}
+
+/* Color all present outputs are expected to show; see slideshow() */
+static uint32_t shown_color;
+
+static bool
+outputs_show_color(void)
+{
+    if (!outputs_shown())
+        return false;
+
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->output != NULL && !surf->output->removed &&
+            surface_shown(surf) && surf->color != shown_color)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* No surfaces remain on removed outputs */
+static bool
+removed_outputs_released(void)
+{
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->output != NULL && surf->output->removed)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * wbg keeps (at most) the shown buffer, and one being rendered, per
+ * output. Anything beyond that is leaked.
+ */
+static int64_t
+shm_bound(void)
+{
+    int64_t bound = 0;
+    for (size_t i = 0; i < output_count; i++) {
+        const struct output *output = &outputs[i];
+        if (!output->removed)
+            bound += 2 * (int64_t)output->width * output->height * 4;
+    }
+    return bound;
+}
+
+static bool
+shm_within_bound(void)
+{
+    return shm_live <= shm_bound();
+}
+
+/* Sends ‘count’ configure events, alternating sizes, to every surface */
+static bool
+configure_storm(int count)
+{
+    for (int i = 0; i < count; i++) {
+        struct surface *surf;
+        wl_list_for_each(surf, &surfaces, link) {
+            if (surf->layer == NULL || surf->output == NULL)
+                continue;
+
+            const struct output *output = surf->output;
+            const uint32_t shrink = i % 2 == 0 ? 16 : 0;
+
+            surface_configure(
+                surf,
+                output->width / output->scale - shrink,
+                output->height / output->scale - shrink);
+        }
+
+        /* Let wbg process some of them at a time */
+        wl_display_flush_clients(display);
+        wl_event_loop_dispatch(loop, 0);
+    }
+
+    /* The last configure was for the full size */
+    if (count % 2 == 1) {
+        struct surface *surf;
+        wl_list_for_each(surf, &surfaces, link) {
+            if (surf->layer != NULL && surf->output != NULL)
+                surface_configure_output_size(surf);
+        }
+    }
+
+    return run_until(&outputs_shown, "configure storm to settle") &&
+        run_until(&shm_within_bound, "SHM buffers to be freed");
+}
+
+/* Plugs an output in, waits for wbg to show the wallpaper, and unplugs it */
+static bool
+hotplug(struct output *output)
+{
+    output_add(output);
+
+    if (!run_until(&outputs_shown, "hot-plugged output"))
+        return false;
+
+    struct surface *surf;
+    wl_list_for_each(surf, &surfaces, link) {
+        if (surf->output == output && surf->layer != NULL)
+            zwlr_layer_surface_v1_send_closed(surf->layer);
+    }
+
+    output->removed = true;
+    wl_global_remove(output->global);
+
+    bool ret = run_until(&removed_outputs_released, "unplugged output to be released") &&
+        run_until(&shm_within_bound, "SHM buffers of unplugged output to be freed");
+
+    wl_global_destroy(output->global);
+    output->global = NULL;
+    return ret;
+}
+
+/*
+ * Lets a --dir slideshow, of the test image, a second image of another
+ * color, and an unloadable one, run for ‘count’ one second intervals.
+ * All outputs must switch to the other color within each interval.
+ * Every preload of the unloadable image fails, and neither it, nor
+ * the previous image, may leave buffers behind.
+ */
+static bool
+slideshow(int count)
+{
+    for (int i = 0; i < count; i++) {
+        shown_color = i % 2 == 0 ? SLIDE_COLOR : TEST_COLOR;
+
+        if (!run_until_within(&outputs_show_color, "the next slideshow image",
+                              SLIDE_SWITCH_MS) ||
+            !run_until(&shm_within_bound, "SHM buffers of previous images to be freed"))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int
+cmp_double(const void *_a, const void *_b)
+{
+    const double *a = _a;
+    const double *b = _b;
+    return *a < *b ? -1 : *a > *b;
+}
+
+static void
+report(void)
+{
+    qsort(latencies, latency_count, sizeof(latencies[0]), &cmp_double);
+
+    const double median = latency_count > 0 ? latencies[latency_count / 2] : 0;
+    const double p95 = latency_count > 0
+        ? latencies[(size_t)ceil(latency_count * 0.95) - 1] : 0;
+    const double max = latency_count > 0 ? latencies[latency_count - 1] : 0;
+
+    for (size_t i = 0; i < output_count; i++) {
+        const struct output *output = &outputs[i];
+        printf("%-10s %5dx%-5d @%d  first commit: %8.3f ms\n",
+               output->name, output->width, output->height, output->scale,
+               output->first_commit_ms);
+    }
+
+    printf("configure -> commit: %zu samples, median %.3f ms, p95 %.3f ms, max %.3f ms\n",
+           latency_count, median, p95, max);
+    printf("configures: %zu, commits: %zu, buffers: %zu\n",
+           configure_count, commit_count, buffer_count);
+    printf("SHM: %" PRIu64 " bytes allocated, %" PRId64 " bytes peak\n",
+           shm_allocated, shm_peak);
+
+    printf("{\"outputs\":[");
+    for (size_t i = 0; i < output_count; i++) {
+        const struct output *output = &outputs[i];
+        printf("%s{\"name\":\"%s\",\"width\":%d,\"height\":%d,\"scale\":%d,"
+               "\"first_commit_ms\":%.3f}",
+               i > 0 ? "," : "", output->name, output->width, output->height,
+               output->scale, output->first_commit_ms);
+    }
+    printf("],\"latency_ms\":{\"count\":%zu,\"median\":%.3f,\"p95\":%.3f,"
+           "\"max\":%.3f},\"configures\":%zu,\"commits\":%zu,\"buffers\":%zu,"
+           "\"shm_allocated\":%" PRIu64 ",\"shm_peak\":%" PRId64 ",\"failures\":%zu}\n",
+           latency_count, median, p95, max, configure_count, commit_count,
+           buffer_count, shm_allocated, shm_peak, failures);
+}
+
+static bool
+write_file(const char *path, const char *content)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to create", path);
+        return false;
+    }
+
+    fputs(content, fp);
+
+    if (fclose(fp) != 0) {
+        LOG_ERRNO("%s: failed to write", path);
+        return false;
+    }
+    return true;
+}
+
+static bool
+write_test_image(const char *path, uint32_t color)
+{
+    char svg[256];
+    snprintf(svg, sizeof(svg),
+             "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"160\" height=\"90\">"
+             "<rect width=\"160\" height=\"90\" fill=\"#%06x\"/>"
+             "</svg>\n", color);
+    return write_file(path, svg);
+}
+
+/* Probed as an SVG, but fails to load, having no size */
+static bool
+write_unloadable_image(const char *path)
+{
+    return write_file(
+        path, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"0\" height=\"0\"/>\n");
+}
+
+/* Runs ‘argv’, with the (NULL terminated) ‘extra’ arguments appended */
+static bool
+spawn(char *const *argv, char *const *extra)
+{
+    size_t argc = 0;
+    while (argv[argc] != NULL)
+        argc++;
+
+    size_t extra_count = 0;
+    while (extra[extra_count] != NULL)
+        extra_count++;
+
+    char *args[argc + extra_count + 1];
+    memcpy(args, argv, argc * sizeof(args[0]));
+    memcpy(&args[argc], extra, (extra_count + 1) * sizeof(args[0]));
+
+    child = fork();
+    if (child < 0) {
+        LOG_ERRNO("failed to fork");
+        return false;
+    }
+
+    if (child == 0) {
+        execvp(args[0], args);
+        fprintf(stderr, "%s: failed to execute: %s\n", args[0], strerror(errno));
+        _exit(127);
+    }
+
+    return true;
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    remove(path);
+    return 0;
+}
+
+static bool
+parse_output(const char *s, struct output *output)
+{
+    int n = -1;
+    output->scale = 1;
+
+    if (sscanf(s, "%dx%d%n", &output->width, &output->height, &n) < 2 || n < 0)
+        return false;
+
+    if (s[n] == '@') {
+        int m = -1;
+        if (sscanf(&s[n + 1], "%d%n", &output->scale, &m) < 1 || m < 0)
+            return false;
+        n += 1 + m;
+    }
+
+    return s[n] == '\0' &&
+        output->width > 0 && output->height > 0 && output->scale > 0 &&
+        output->width % output->scale == 0 &&
+        output->height % output->scale == 0;
+}
+
+static void
+usage(const char *progname)
+{
+    printf("Usage: %s [OPTIONS] -- WBG [WBG OPTIONS]\n"
+           "\n"
+           "Runs WBG against a mock compositor. A generated test image (or,\n"
+           "with --slideshow, a directory) is appended to its arguments.\n"
+           "\n"
+           "Options:\n"
+           "  -o,--output=WxH[@N]  announce an output of WxH pixels, with scale N (repeatable; default: 1920x1080)\n"
+           "  -s,--storm=COUNT     send COUNT configure events, of alternating sizes, to each output\n"
+           "  -H,--hotplug=COUNT   plug in, and remove, an additional output COUNT times\n"
+           "  -d,--slideshow=COUNT run WBG with --dir, of the test image, one of another color, and an unloadable one, for COUNT one second intervals\n"
+           "  -u,--unloadable-first with --slideshow, name the unloadable image so that it sorts first\n"
+           "  -t,--timeout=SECS    time to wait for wbg at each step (default: 10)\n"
+           , progname);
+}
+
+int
+main(int argc, char *const *argv)
+{
+    const char *progname = argv[0];
+
+    const struct option longopts[] = {
+        {"output",  required_argument, NULL, 'o'},
+        {"storm",   required_argument, NULL, 's'},
+        {"hotplug", required_argument, NULL, 'H'},
+        {"slideshow", required_argument, NULL, 'd'},
+        {"unloadable-first", no_argument, NULL, 'u'},
+        {"timeout", required_argument, NULL, 't'},
+        {"help",    no_argument, 0, 'h'},
+        {NULL,      no_argument, 0, 0},
+    };
+
+    int storm = 0;
+    int hotplug_count = 0;
+    int slideshow_count = 0;
+    bool unloadable_first = false;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "+:o:s:H:d:ut:h", longopts, NULL);
+        if (c < 0)
+            break;
+
+        switch (c) {
+        case 'o':
+            if (output_count >= MAX_OUTPUTS - 1) {
+                fprintf(stderr, "error: -o: too many outputs\n");
+                return EXIT_FAILURE;
+            }
+            if (!parse_output(optarg, &outputs[output_count])) {
+                fprintf(stderr, "error: -o: %s: invalid output size\n", optarg);
+                return EXIT_FAILURE;
+            }
+            output_count++;
+            break;
+
+        case 's':
+            storm = atoi(optarg);
+            break;
+
+        case 'H':
+            hotplug_count = atoi(optarg);
+            break;
+
+        case 'd':
+            slideshow_count = atoi(optarg);
+            break;
+
+        case 'u':
+            unloadable_first = true;
+            break;
+
+        case 't':
+            timeout_ms = atoi(optarg) * 1000;
+            break;
+
+        case 'h':
+            usage(progname);
+            return EXIT_SUCCESS;
+
+        case ':':
+            fprintf(stderr, "error: -%c: missing required argument\n", optopt);
+            return EXIT_FAILURE;
+
+        case '?':
+            fprintf(stderr, "error: -%c: invalid option\n", optopt);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(progname);
+        return EXIT_FAILURE;
+    }
+
+    if (output_count == 0)
+        outputs[output_count++] = (struct output){.width = 1920, .height = 1080, .scale = 1};
+
+    log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, LOG_CLASS_WARNING);
+    wl_list_init(&surfaces);
+
+    int exit_code = EXIT_FAILURE;
+
+    /* Holds the socket (if needed), the test image and wbg's cache */
+    const char *tmp = getenv("TMPDIR");
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/wbg-mock.XXXXXX",
+             tmp != NULL ? tmp : "/tmp");
+
+    if (mkdtemp(tmp_dir) == NULL) {
+        LOG_ERRNO("%s: failed to create directory", tmp_dir);
+        tmp_dir[0] = '\0';
+        goto out;
+    }
+
+    if (getenv("XDG_RUNTIME_DIR") == NULL)
+        setenv("XDG_RUNTIME_DIR", tmp_dir, 1);
+
+    char image_dir[PATH_MAX + 16];
+    snprintf(image_dir, sizeof(image_dir), "%s/images", tmp_dir);
+    if (mkdir(image_dir, 0700) < 0) {
+        LOG_ERRNO("%s: failed to create directory", image_dir);
+        goto out;
+    }
+
+    /*
+     * The second image sorts after the test image. The unloadable one
+     * sorts after both, or with --unloadable-first, before them; either
+     * way, wbg must start by showing the test image.
+     */
+    char image_path[PATH_MAX + 32];
+    char slide_path[PATH_MAX + 32];
+    char unloadable_path[PATH_MAX + 32];
+    snprintf(image_path, sizeof(image_path), "%s/test.svg", image_dir);
+    snprintf(slide_path, sizeof(slide_path), "%s/test2.svg", image_dir);
+    snprintf(unloadable_path, sizeof(unloadable_path), "%s/%sunloadable.svg",
+             image_dir, unloadable_first ? "0-" : "");
+
+    if (!write_test_image(image_path, TEST_COLOR))
+        goto out;
+
+    if (slideshow_count > 0) {
+        if (!write_test_image(slide_path, SLIDE_COLOR) ||
+            !write_unloadable_image(unloadable_path))
+        {
+            goto out;
+        }
+        slideshow_colors = true;
+    }
+
+    char dir_arg[PATH_MAX + 32];
+    snprintf(dir_arg, sizeof(dir_arg), "--dir=%s", image_dir);
+
+    char *const image_args[] = {image_path, NULL};
+    char *const slideshow_args[] = {dir_arg, "--interval=1", NULL};
+
+    /* A fresh frame cache; every frame is rendered */
+    setenv("XDG_CACHE_HOME", tmp_dir, 1);
+
+    if ((display = wl_display_create()) == NULL) {
+        LOG_ERR("failed to create display");
+        goto out;
+    }
+
+    loop = wl_display_get_event_loop(display);
+
+    const char *socket = wl_display_add_socket_auto(display);
+    if (socket == NULL) {
+        LOG_ERRNO("failed to add socket");
+        goto out;
+    }
+
+    setenv("WAYLAND_DISPLAY", socket, 1);
+    unsetenv("WAYLAND_SOCKET");
+
+    wl_global_create(display, &wl_compositor_interface, 4, NULL, &compositor_bind);
+    wl_global_create(display, &wl_shm_interface, 1, NULL, &shm_bind);
+    wl_global_create(
+        display, &zwlr_layer_shell_v1_interface, 2, NULL, &layer_shell_bind);
+
+    for (size_t i = 0; i < output_count; i++) {
+        snprintf(outputs[i].name, sizeof(outputs[i].name), "MOCK-%zu", i + 1);
+        output_add(&outputs[i]);
+    }
+
+    if (!spawn(&argv[optind], slideshow_count > 0 ? slideshow_args : image_args))
+        goto out;
+
+    if (!run_until(&outputs_shown, "the wallpaper on all outputs"))
+        goto out;
+
+    if (storm > 0 && !configure_storm(storm))
+        goto out;
+
+    if (hotplug_count > 0) {
+        struct output *extra = &outputs[output_count];
+        *extra = outputs[0];
+        snprintf(extra->name, sizeof(extra->name), "MOCK-%zu", ++output_count);
+
+        for (int i = 0; i < hotplug_count; i++) {
+            if (!hotplug(extra))
+                goto out;
+        }
+    }
+
+    if (slideshow_count > 0 && !slideshow(slideshow_count))
+        goto out;
+
+    /* Catch anything wbg does after it should have gone idle */
+    run_for(100);
+
+    if (!child_running()) {
+        FAIL("wbg exited prematurely");
+        goto out;
+    }
+
+    kill(child, SIGINT);
+    if (waitpid(child, &child_status, 0) == child)
+        child = -1;
+
+    /*
+     * wbg blocks SIGINT before starting any threads, and exits
+     * cleanly on it; being killed by it means the mask regressed.
+     */
+    if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+        if (WIFSIGNALED(child_status))
+            FAIL("wbg was killed by signal %d", WTERMSIG(child_status));
+        else
+            FAIL("wbg did not exit cleanly (status 0x%x)", child_status);
+    }
+
+    if (failures == 0)
+        exit_code = EXIT_SUCCESS;
+
+out:
+    if (display != NULL)
+        report();
+
+    if (child > 0) {
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+    }
+
+    if (display != NULL) {
+        wl_display_destroy_clients(display);
+        wl_display_destroy(display);
+    }
+
+    if (tmp_dir[0] != '\0')
+        nftw(tmp_dir, &remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    free(latencies);
+    log_deinit();
+    return exit_code;
+}
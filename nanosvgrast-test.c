@@ -0,0 +1,309 @@
+/*
+ * Conformance test of nanosvgrast's SIMD kernels: the SSE2 and AVX2
+ * blend and gradient kernels must produce exactly what the scalar
+ * ones do. They are compared on random spans, and in full
+ * rasterizations of a generated gradient image, and of the SVG files
+ * given on the command line, with each set of kernels forced in turn.
+ *
+ * Exits with 0 if all match, 1 if not, and 77 (skipped) if the build,
+ * or the CPU, has no SIMD kernels.
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <3rd-party/nanosvg/src/nanosvg.h>
+#define NANOSVGRAST_IMPLEMENTATION
+#include <3rd-party/nanosvg/src/nanosvgrast.h>
+
+#define LOG_MODULE "nanosvgrast-test"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+#define SPAN_ITERATIONS 20000
+
+/* Longer than a span chunk, to cover the kernels' tails */
+#define SPAN_MAX (NSVG__SPAN_CHUNK + 13)
+
+static const struct {
+    enum NSVGkernels kernels;
+    const char *name;
+} simd_kernels[] = {
+    {NSVG_KERNELS_SSE2, "sse2"},
+    {NSVG_KERNELS_AVX2, "avx2"},
+};
+
+/* Linear and radial gradients, with and without opacity */
+static const char gradient_svg[] =
+    "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"320\" height=\"200\">"
+    "<defs>"
+    "<linearGradient id=\"l\" x1=\"0\" y1=\"0\" x2=\"1\" y2=\"0.3\">"
+    "<stop offset=\"0\" stop-color=\"#ff0000\"/>"
+    "<stop offset=\"0.5\" stop-color=\"#00ff00\" stop-opacity=\"0.5\"/>"
+    "<stop offset=\"1\" stop-color=\"#0000ff\"/>"
+    "</linearGradient>"
+    "<radialGradient id=\"r\" cx=\"0.4\" cy=\"0.6\" r=\"0.7\">"
+    "<stop offset=\"0\" stop-color=\"#ffffff\" stop-opacity=\"0.9\"/>"
+    "<stop offset=\"1\" stop-color=\"#203040\" stop-opacity=\"0.2\"/>"
+    "</radialGradient>"
+    "</defs>"
+    "<rect width=\"320\" height=\"200\" fill=\"url(#l)\"/>"
+    "<circle cx=\"160\" cy=\"100\" r=\"90\" fill=\"url(#r)\"/>"
+    "<ellipse cx=\"60\" cy=\"150\" rx=\"50\" ry=\"30\" fill=\"url(#r)\" opacity=\"0.6\"/>"
+    "<path d=\"M10 10 L300 40 L200 190 Z\" fill=\"#336699\" fill-opacity=\"0.7\"/>"
+    "</svg>";
+
+/* Deterministic, so that failures can be reproduced */
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t
+rnd(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static float
+rnd_float(float min, float max)
+{
+    return min + (max - min) * (rnd() / (float)UINT32_MAX);
+}
+
+/* Random bytes, with runs of zero and full coverage */
+static void
+random_coverage(unsigned char *cover, int count)
+{
+    for (int i = 0; i < count; ) {
+        const int run = 1 + rnd() % 12;
+        const uint32_t kind = rnd() % 4;
+
+        for (int j = 0; j < run && i < count; j++, i++)
+            cover[i] = kind == 0 ? 0 : kind == 1 ? 255 : rnd() & 0xff;
+    }
+}
+
+static unsigned int
+random_color(void)
+{
+    unsigned int color = rnd();
+
+    /* Fully transparent, and opaque, colors are special cased by callers */
+    switch (rnd() % 4) {
+    case 0: return color & 0x00ffffff;
+    case 1: return color | 0xff000000;
+    default: return color;
+    }
+}
+
+static bool
+test_blend(NSVGrasterizer *ref, NSVGrasterizer *r, const char *name)
+{
+    for (int iter = 0; iter < SPAN_ITERATIONS; iter++) {
+        unsigned char cover[SPAN_MAX];
+        unsigned int colors[SPAN_MAX];
+        unsigned char expected[SPAN_MAX * 4 + 4];
+        unsigned char actual[SPAN_MAX * 4 + 4];
+
+        const int count = rnd() % (SPAN_MAX + 1);
+
+        /* Unaligned destinations */
+        const int offset = rnd() % 4;
+
+        random_coverage(cover, count);
+        for (int i = 0; i < count; i++)
+            colors[i] = random_color();
+        for (size_t i = 0; i < sizeof(expected); i++)
+            expected[i] = rnd() & 0xff;
+        memcpy(actual, expected, sizeof(actual));
+
+        ref->blend(&expected[offset], cover, colors, count);
+        r->blend(&actual[offset], cover, colors, count);
+
+        if (memcmp(expected, actual, sizeof(expected)) != 0) {
+            for (size_t i = 0; i < sizeof(expected); i++) {
+                if (expected[i] == actual[i])
+                    continue;
+
+                LOG_ERR("%s: span %d (%d pixels): byte %zu is "
+                        "0x%02x, expected 0x%02x",
+                        name, iter, count, i, actual[i], expected[i]);
+                break;
+            }
+            return false;
+        }
+    }
+
+    printf("%-24s %6d spans ok\n", name, SPAN_ITERATIONS);
+    return true;
+}
+
+static bool
+test_gradient(NSVGgradientFunc ref_func, NSVGgradientFunc func, const char *name)
+{
+    unsigned int lut[256];
+
+    for (int iter = 0; iter < SPAN_ITERATIONS; iter++) {
+        unsigned int expected[SPAN_MAX];
+        unsigned int actual[SPAN_MAX];
+
+        if (iter % 64 == 0) {
+            for (size_t i = 0; i < 256; i++)
+                lut[i] = rnd();
+        }
+
+        const int count = rnd() % (SPAN_MAX + 1);
+
+        /* Positions that run below, through, and beyond the gradient */
+        float t[6];
+        for (size_t i = 0; i < 4; i++)
+            t[i] = rnd_float(-0.02f, 0.02f);
+        t[4] = rnd_float(-1.5f, 1.5f);
+        t[5] = rnd_float(-1.5f, 1.5f);
+
+        const float fx = rnd_float(-10.f, 2000.f);
+        const float fy = rnd_float(-10.f, 2000.f);
+        const float steps[] = {1.f, 0.5f, 1.f / 3, rnd_float(0.01f, 4.f)};
+        const float dx = steps[rnd() % 4];
+
+        const float expected_fx = ref_func(expected, count, fx, fy, dx, t, lut);
+        const float actual_fx = func(actual, count, fx, fy, dx, t, lut);
+
+        if (memcmp(expected, actual, count * sizeof(expected[0])) != 0 ||
+            memcmp(&expected_fx, &actual_fx, sizeof(float)) != 0)
+        {
+            LOG_ERR("%s: span %d (%d pixels, dx=%g) differs",
+                    name, iter, count, dx);
+            return false;
+        }
+    }
+
+    printf("%-24s %6d spans ok\n", name, SPAN_ITERATIONS);
+    return true;
+}
+
+/* Rasterizes ‘image’ with each set of kernels, at a few scales */
+static bool
+test_raster(NSVGimage *image, const char *image_name,
+            NSVGrasterizer *ref, NSVGrasterizer *r, const char *name)
+{
+    static const float scales[] = {0.37f, 1.f, 2.5f};
+
+    for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+        const float scale = scales[i];
+        const int width = ceilf(image->width * scale);
+        const int height = ceilf(image->height * scale);
+        const int stride = width * 4;
+
+        unsigned char *expected = malloc((size_t)height * stride);
+        unsigned char *actual = malloc((size_t)height * stride);
+
+        if (expected == NULL || actual == NULL) {
+            free(expected);
+            free(actual);
+            LOG_ERR("%s: out of memory", image_name);
+            return false;
+        }
+
+        nsvgRasterize(ref, image, 0, 0, scale, expected, width, height, stride);
+        nsvgRasterize(r, image, 0, 0, scale, actual, width, height, stride);
+
+        const bool ok = memcmp(expected, actual, (size_t)height * stride) == 0;
+        free(expected);
+        free(actual);
+
+        if (!ok) {
+            LOG_ERR("%s: %s, %dx%d differs", name, image_name, width, height);
+            return false;
+        }
+
+        printf("%-24s %s, %dx%d ok\n", name, image_name, width, height);
+    }
+
+    return true;
+}
+
+int
+main(int argc, char *const *argv)
+{
+    log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, LOG_CLASS_WARNING);
+
+    int exit_code = EXIT_FAILURE;
+    size_t tested = 0;
+    size_t failures = 0;
+
+    NSVGimage *gradients = NULL;
+    NSVGrasterizer *ref = nsvgCreateRasterizer();
+    NSVGrasterizer *r = nsvgCreateRasterizer();
+
+    if (ref == NULL || r == NULL)
+        goto out;
+
+    nsvgRasterizerUseKernels(ref, NSVG_KERNELS_SCALAR);
+
+    /* nsvgParse() wants a mutable string */
+    char svg[sizeof(gradient_svg)];
+    memcpy(svg, gradient_svg, sizeof(svg));
+    if ((gradients = nsvgParse(svg, "px", 96)) == NULL) {
+        LOG_ERR("failed to parse the gradient image");
+        goto out;
+    }
+
+    for (size_t i = 0; i < sizeof(simd_kernels) / sizeof(simd_kernels[0]); i++) {
+        const char *name = simd_kernels[i].name;
+
+        if (!nsvgRasterizerUseKernels(r, simd_kernels[i].kernels)) {
+            printf("%-24s not supported; skipped\n", name);
+            continue;
+        }
+
+        tested++;
+
+        char label[32];
+        snprintf(label, sizeof(label), "blend (%s)", name);
+        if (!test_blend(ref, r, label))
+            failures++;
+
+        snprintf(label, sizeof(label), "linear (%s)", name);
+        if (!test_gradient(ref->linearColors, r->linearColors, label))
+            failures++;
+
+        snprintf(label, sizeof(label), "radial (%s)", name);
+        if (!test_gradient(ref->radialColors, r->radialColors, label))
+            failures++;
+
+        snprintf(label, sizeof(label), "raster (%s)", name);
+        if (!test_raster(gradients, "gradients", ref, r, label))
+            failures++;
+
+        for (int j = 1; j < argc; j++) {
+            NSVGimage *image = nsvgParseFromFile(argv[j], "px", 96);
+            if (image == NULL || image->width == 0 || image->height == 0) {
+                LOG_ERR("%s: failed to parse", argv[j]);
+                failures++;
+            } else if (!test_raster(image, argv[j], ref, r, label))
+                failures++;
+
+            if (image != NULL)
+                nsvgDelete(image);
+        }
+    }
+
+    if (tested == 0) {
+        printf("no SIMD kernels; skipped\n");
+        exit_code = 77;
+    } else if (failures == 0)
+        exit_code = EXIT_SUCCESS;
+
+out:
+    if (gradients != NULL)
+        nsvgDelete(gradients);
+    nsvgDeleteRasterizer(ref);
+    nsvgDeleteRasterizer(r);
+    log_deinit();
+    return exit_code;
+}
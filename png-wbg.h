@@ -1,6 +1,10 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <pixman.h>
 
 pixman_image_t *png_load(FILE *fp, const char *path);
+
+/* Writes an XRGB image as 8-bit RGB */
+bool png_save(const char *path, pixman_image_t *pix);
@@ -12,6 +12,7 @@
 #define LOG_MODULE "png"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
+#include "premultiply.h"
 #include "stride.h"
 
 pixman_image_t *
@@ -68,8 +69,9 @@ png_load(FILE *fp, const char *path)
     png_set_strip_16(png_ptr);  /* "pack" 16-bit colors to 8-bit */
     png_set_bgr(png_ptr);
 
-    /* Tell libpng to expand to RGB(A) when necessary, and tell pixman
-     * whether we have alpha or not */
+    /* Tell libpng to expand to BGR(A) when necessary, and tell pixman
+     * whether we have alpha or not. Images without alpha get a filler
+     * byte, making everything 32bpp */
     pixman_format_code_t format;
 
     switch (color_type) {
@@ -82,7 +84,7 @@ png_load(FILE *fp, const char *path)
             png_set_expand_gray_1_2_4_to_8(png_ptr);
 
         png_set_gray_to_rgb(png_ptr);
-        format = color_type == PNG_COLOR_TYPE_GRAY ? PIXMAN_r8g8b8 : PIXMAN_x8r8g8b8;
+        format = color_type == PNG_COLOR_TYPE_GRAY ? PIXMAN_x8r8g8b8 : PIXMAN_a8r8g8b8;
         break;
 
     case PNG_COLOR_TYPE_PALETTE:
@@ -92,22 +94,25 @@ png_load(FILE *fp, const char *path)
         png_set_palette_to_rgb(png_ptr);
         if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
             png_set_tRNS_to_alpha(png_ptr);
-            format = PIXMAN_x8r8g8b8;
+            format = PIXMAN_a8r8g8b8;
         } else
-            format = PIXMAN_r8g8b8;
+            format = PIXMAN_x8r8g8b8;
         break;
 
     case PNG_COLOR_TYPE_RGB:
         LOG_DBG("RGB");
-        format = PIXMAN_r8g8b8;
+        format = PIXMAN_x8r8g8b8;
         break;
 
     case PNG_COLOR_TYPE_RGBA:
         LOG_DBG("RGBA");
-        format = PIXMAN_x8r8g8b8;
+        format = PIXMAN_a8r8g8b8;
         break;
     }
 
+    if (format == PIXMAN_x8r8g8b8)
+        png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
+
     png_read_update_info(png_ptr, info_ptr);
 
     size_t row_bytes __attribute__((unused)) = png_get_rowbytes(png_ptr, info_ptr);
@@ -124,30 +129,8 @@ png_load(FILE *fp, const char *path)
     png_read_image(png_ptr, row_pointers);
 
     /* pixman expects pre-multiplied alpha */
-    if (format == PIXMAN_x8r8g8b8) {
-        for (int i = 0; i < height; i++) {
-            uint32_t *p = (uint32_t *)row_pointers[i];
-            for (int j = 0; j < width; j++, p++) {
-                uint8_t a = (*p >> 24) & 0xff;
-                uint8_t r = (*p >> 16) & 0xff;
-                uint8_t g = (*p >> 8) & 0xff;
-                uint8_t b = (*p >> 0) & 0xff;
-
-                if (a == 0xff)
-                    continue;
-
-                if (a == 0) {
-                    r = g = b = 0;
-                } else {
-                    r = r * a / 0xff;
-                    g = g * a / 0xff;
-                    b = b * a / 0xff;
-                }
-
-                *p = (uint32_t)a << 24 | r << 16 | g << 8 | b;
-            }
-        }
-    }
+    if (format == PIXMAN_a8r8g8b8)
+        premultiply((uint32_t *)image_data, (size_t)height * stride / 4, false);
 
     pix = pixman_image_create_bits_no_clear(
         format, width, height, (uint32_t *)image_data, stride);
@@ -161,3 +144,73 @@ err:
 
     return pix;
 }
+
+bool
+png_save(const char *path, pixman_image_t *pix)
+{
+    assert(pixman_image_get_format(pix) == PIXMAN_x8r8g8b8);
+
+    const int width = pixman_image_get_width(pix);
+    const int height = pixman_image_get_height(pix);
+    const int stride = pixman_image_get_stride(pix);
+    const uint8_t *data = (const uint8_t *)pixman_image_get_data(pix);
+
+    bool ret = false;
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    uint8_t *row = NULL;
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LOG_ERRNO("%s: failed to open", path);
+        return false;
+    }
+
+    if ((row = malloc((size_t)width * 3)) == NULL ||
+        (png_ptr = png_create_write_struct(
+             PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL ||
+        (info_ptr = png_create_info_struct(png_ptr)) == NULL)
+    {
+        LOG_ERR("%s: failed to initialize libpng", path);
+        goto out;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        LOG_ERR("%s: libpng error", path);
+        goto out;
+    }
+
+    png_init_io(png_ptr, fp);
+    png_set_IHDR(
+        png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB,
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+        PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+
+    for (int y = 0; y < height; y++) {
+        const uint32_t *src = (const uint32_t *)&data[y * stride];
+
+        for (int x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x] >> 16;
+            row[x * 3 + 1] = src[x] >> 8;
+            row[x * 3 + 2] = src[x];
+        }
+
+        png_write_row(png_ptr, row);
+    }
+
+    png_write_end(png_ptr, NULL);
+    ret = true;
+
+out:
+    if (png_ptr != NULL)
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+    free(row);
+
+    if (fclose(fp) != 0 && ret) {
+        LOG_ERRNO("%s: failed to write", path);
+        ret = false;
+    }
+
+    return ret;
+}
@@ -0,0 +1,209 @@
+#include "premultiply.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+ #include <immintrin.h>
+ #define HAVE_X86_KERNELS 1
+#endif
+
+#define LOG_MODULE "premultiply"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+typedef void (*kernel_t)(uint32_t *pixels, size_t count, bool swap_rb);
+
+static inline uint32_t
+premultiply_pixel(uint32_t p, bool swap_rb)
+{
+    uint8_t alpha = (p >> 24) & 0xff;
+    uint8_t c2 = (p >> 16) & 0xff;
+    uint8_t c1 = (p >> 8) & 0xff;
+    uint8_t c0 = (p >> 0) & 0xff;
+
+    if (alpha == 0x00)
+        c2 = c1 = c0 = 0x00;
+    else if (alpha != 0xff) {
+        c2 = c2 * alpha / 0xff;
+        c1 = c1 * alpha / 0xff;
+        c0 = c0 * alpha / 0xff;
+    }
+
+    return swap_rb
+        ? (uint32_t)alpha << 24 | c0 << 16 | c1 << 8 | c2
+        : (uint32_t)alpha << 24 | c2 << 16 | c1 << 8 | c0;
+}
+
+static void
+premultiply_generic(uint32_t *pixels, size_t count, bool swap_rb)
+{
+    for (size_t i = 0; i < count; i++) {
+        /* Fully opaque pixels only need swizzling, if anything */
+        if (!swap_rb && (pixels[i] >> 24) == 0xff)
+            continue;
+
+        pixels[i] = premultiply_pixel(pixels[i], swap_rb);
+    }
+}
+
+#if defined(HAVE_X86_KERNELS)
+
+/*
+ * x / 255 == (x * 0x8081) >> 23, for all x = c * a, where c, a <= 255.
+ *
+ * The alpha lane is multiplied by 255 instead of by itself, so that
+ * it comes out unchanged.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+premultiply_sse2_half(__m128i px, bool swap_rb)
+{
+    const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i div = _mm_set1_epi16((short)0x8081);
+
+    __m128i alpha = _mm_shufflehi_epi16(
+        _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_or_si128(_mm_andnot_si128(alpha_lanes, alpha),
+                         _mm_and_si128(alpha_lanes, _mm_set1_epi16(0xff)));
+
+    __m128i res = _mm_mullo_epi16(px, alpha);
+    res = _mm_srli_epi16(_mm_mulhi_epu16(res, div), 7);
+
+    if (swap_rb) {
+        res = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(res, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    return res;
+}
+
+__attribute__((target("sse2")))
+static void
+premultiply_sse2(uint32_t *pixels, size_t count, bool swap_rb)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+    const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i *p = (__m128i *)&pixels[i];
+        __m128i px = _mm_loadu_si128(p);
+
+        /* Opaque run; at most a swizzle */
+        __m128i opaque = _mm_cmpeq_epi32(_mm_and_si128(px, alpha_mask), alpha_mask);
+        if (_mm_movemask_epi8(opaque) == 0xffff) {
+            if (swap_rb) {
+                __m128i rb = _mm_and_si128(px, rb_mask);
+                rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+                px = _mm_or_si128(_mm_andnot_si128(rb_mask, px),
+                                  _mm_and_si128(rb, rb_mask));
+                _mm_storeu_si128(p, px);
+            }
+            continue;
+        }
+
+        __m128i lo = premultiply_sse2_half(_mm_unpacklo_epi8(px, zero), swap_rb);
+        __m128i hi = premultiply_sse2_half(_mm_unpackhi_epi8(px, zero), swap_rb);
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+
+    premultiply_generic(&pixels[i], count - i, swap_rb);
+}
+
+__attribute__((target("avx2")))
+static void
+premultiply_avx2(uint32_t *pixels, size_t count, bool swap_rb)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xff000000);
+    const __m256i alpha_lanes = _mm256_set1_epi64x((long long)0xffff000000000000ull);
+    const __m256i div = _mm256_set1_epi16((short)0x8081);
+
+    /* Per 16-bit pixel: broadcast alpha, and swap lanes 0 and 2 */
+    const __m256i alpha_shuf = _mm256_set_epi8(
+        15, 14, 15, 14, 15, 14, 15, 14, 7, 6, 7, 6, 7, 6, 7, 6,
+        15, 14, 15, 14, 15, 14, 15, 14, 7, 6, 7, 6, 7, 6, 7, 6);
+    const __m256i swap16_shuf = _mm256_set_epi8(
+        15, 14, 9, 8, 11, 10, 13, 12, 7, 6, 1, 0, 3, 2, 5, 4,
+        15, 14, 9, 8, 11, 10, 13, 12, 7, 6, 1, 0, 3, 2, 5, 4);
+    const __m256i swap8_shuf = _mm256_set_epi8(
+        15, 12, 13, 14, 11, 8, 9, 10, 7, 4, 5, 6, 3, 0, 1, 2,
+        15, 12, 13, 14, 11, 8, 9, 10, 7, 4, 5, 6, 3, 0, 1, 2);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i *p = (__m256i *)&pixels[i];
+        __m256i px = _mm256_loadu_si256(p);
+
+        /* Opaque run; at most a swizzle */
+        __m256i opaque = _mm256_cmpeq_epi32(
+            _mm256_and_si256(px, alpha_mask), alpha_mask);
+        if (_mm256_movemask_epi8(opaque) == -1) {
+            if (swap_rb)
+                _mm256_storeu_si256(p, _mm256_shuffle_epi8(px, swap8_shuf));
+            continue;
+        }
+
+        __m256i halves[2] = {
+            _mm256_unpacklo_epi8(px, zero),
+            _mm256_unpackhi_epi8(px, zero),
+        };
+
+        for (size_t j = 0; j < 2; j++) {
+            __m256i alpha = _mm256_shuffle_epi8(halves[j], alpha_shuf);
+            alpha = _mm256_blendv_epi8(alpha, _mm256_set1_epi16(0xff), alpha_lanes);
+
+            __m256i res = _mm256_mullo_epi16(halves[j], alpha);
+            res = _mm256_srli_epi16(_mm256_mulhi_epu16(res, div), 7);
+
+            if (swap_rb)
+                res = _mm256_shuffle_epi8(res, swap16_shuf);
+
+            halves[j] = res;
+        }
+
+        _mm256_storeu_si256(p, _mm256_packus_epi16(halves[0], halves[1]));
+    }
+
+    premultiply_sse2(&pixels[i], count - i, swap_rb);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+static kernel_t kernel = &premultiply_generic;
+static const char *kernel_name = "generic";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void
+select_kernel(void)
+{
+#if defined(HAVE_X86_KERNELS)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = &premultiply_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = &premultiply_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+
+    LOG_DBG("using %s kernel", kernel_name);
+}
+
+void
+premultiply(uint32_t *pixels, size_t count, bool swap_rb)
+{
+    pthread_once(&kernel_once, &select_kernel);
+    kernel(pixels, count, swap_rb);
+}
+
+const char *
+premultiply_kernel_name(void)
+{
+    pthread_once(&kernel_once, &select_kernel);
+    return kernel_name;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Converts non-premultiplied pixels to premultiplied ARGB (i.e. BGRA
+ * in little endian memory), in place.
+ *
+ * With ‘swap_rb’, the input is ABGR (RGBA in memory, as produced by
+ * libjxl and nanosvg), and red and blue are swapped.
+ *
+ * The result is identical to c * a / 0xff, per color channel. SSE2
+ * or AVX2 kernels are selected at runtime, when available.
+ */
+void premultiply(uint32_t *pixels, size_t count, bool swap_rb);
+
+/* Name of the kernel in use, e.g. "avx2" */
+const char *premultiply_kernel_name(void);
@@ -0,0 +1,133 @@
+#include "scale-cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <tllist.h>
+
+#define LOG_MODULE "scale-cache"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+struct entry {
+    struct scale_cache_key key;
+    pixman_format_code_t format;
+    int stride;
+    size_t size;
+    uint8_t *data;
+};
+
+/* Most recently used entry first */
+static tll(struct entry) entries = tll_init();
+static size_t max_size = 0;
+static size_t total_size = 0;
+
+static bool
+key_equal(const struct scale_cache_key *a, const struct scale_cache_key *b)
+{
+    return a->width == b->width &&
+        a->height == b->height &&
+        a->scale == b->scale &&
+        a->stretch == b->stretch;
+}
+
+static void
+entry_free(struct entry e)
+{
+    total_size -= e.size;
+    free(e.data);
+}
+
+void
+scale_cache_init(size_t _max_size)
+{
+    max_size = _max_size;
+}
+
+void
+scale_cache_fini(void)
+{
+    scale_cache_clear();
+}
+
+void
+scale_cache_clear(void)
+{
+    tll_free_and_free(entries, entry_free);
+    total_size = 0;
+}
+
+bool
+scale_cache_lookup(const struct scale_cache_key *key, pixman_image_t *dst)
+{
+    tll_foreach(entries, it) {
+        struct entry *e = &it->item;
+        if (!key_equal(&e->key, key))
+            continue;
+
+        const int height = pixman_image_get_height(dst);
+        if (e->format != pixman_image_get_format(dst) ||
+            e->stride != pixman_image_get_stride(dst) ||
+            e->size != (size_t)e->stride * height)
+        {
+            return false;
+        }
+
+        memcpy(pixman_image_get_data(dst), e->data, e->size);
+
+        if (it != entries.head) {
+            struct entry copy = *e;
+            tll_remove(entries, it);
+            tll_push_front(entries, copy);
+        }
+
+        LOG_DBG("hit: %dx%d@%d%s", key->width, key->height, key->scale,
+                key->stretch ? " (stretched)" : "");
+        return true;
+    }
+
+    return false;
+}
+
+void
+scale_cache_insert(const struct scale_cache_key *key, pixman_image_t *src)
+{
+    const int stride = pixman_image_get_stride(src);
+    const size_t size = (size_t)stride * pixman_image_get_height(src);
+
+    if (size > max_size)
+        return;
+
+    /* Replace any stale entry with the same key */
+    tll_foreach(entries, it) {
+        if (key_equal(&it->item.key, key)) {
+            entry_free(it->item);
+            tll_remove(entries, it);
+            break;
+        }
+    }
+
+    while (total_size + size > max_size && tll_length(entries) > 0) {
+        struct entry e = tll_pop_back(entries);
+        LOG_DBG("evicting: %dx%d@%d", e.key.width, e.key.height, e.key.scale);
+        entry_free(e);
+    }
+
+    uint8_t *data = malloc(size);
+    if (data == NULL) {
+        LOG_WARN("failed to allocate %zu bytes for scaled image", size);
+        return;
+    }
+
+    memcpy(data, pixman_image_get_data(src), size);
+
+    tll_push_front(
+        entries, ((struct entry){
+            .key = *key,
+            .format = pixman_image_get_format(src),
+            .stride = stride,
+            .size = size,
+            .data = data}));
+    total_size += size;
+}
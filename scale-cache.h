@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pixman.h>
+
+/* Geometry a scaled (or rasterized SVG) image was rendered for */
+struct scale_cache_key {
+    int width;
+    int height;
+    int scale;
+    bool stretch;
+};
+
+void scale_cache_init(size_t max_size);
+void scale_cache_fini(void);
+
+/* Drops all entries, e.g. when the source image changes */
+void scale_cache_clear(void);
+
+/*
+ * Copies a previously inserted image into ‘dst’. Returns false if
+ * there is no entry for ‘key’, or if ‘dst’ has a different layout.
+ */
+bool scale_cache_lookup(const struct scale_cache_key *key, pixman_image_t *dst);
+
+/* Stores a copy of ‘src’, evicting least recently used entries as needed */
+void scale_cache_insert(const struct scale_cache_key *key, pixman_image_t *src);
@@ -0,0 +1,123 @@
+#include "scale.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#define LOG_MODULE "scale"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "thread-pool.h"
+
+/* Minimum number of rows in a band */
+#define MIN_BAND_HEIGHT 32
+
+/* Bands per thread; more than one evens out the load */
+#define BANDS_PER_THREAD 4
+
+struct scale_job {
+    pixman_transform_t transform;
+
+    pixman_format_code_t src_format;
+    int src_width;
+    int src_height;
+    int src_stride;
+    uint32_t *src_data;
+
+    pixman_format_code_t dst_format;
+    int dst_width;
+    int dst_height;
+    int dst_stride;
+    uint8_t *dst_data;
+
+    int band_height;
+};
+
+static void
+scale_band(void *data, size_t idx)
+{
+    const struct scale_job *job = data;
+
+    const int y = idx * job->band_height;
+    const int height = y + job->band_height > job->dst_height
+        ? job->dst_height - y
+        : job->band_height;
+
+    /*
+     * pixman images aren’t safe to share between threads (they are
+     * lazily validated), so each band gets its own images, wrapping
+     * the same pixel memory.
+     *
+     * Every destination pixel is sampled at the same source position
+     * as a single, full-size, composite would, making the result
+     * identical regardless of the number of bands.
+     */
+    pixman_image_t *src = pixman_image_create_bits_no_clear(
+        job->src_format, job->src_width, job->src_height,
+        job->src_data, job->src_stride);
+    pixman_image_t *dst = pixman_image_create_bits_no_clear(
+        job->dst_format, job->dst_width, height,
+        (uint32_t *)(job->dst_data + (size_t)y * job->dst_stride),
+        job->dst_stride);
+
+    if (src == NULL || dst == NULL) {
+        LOG_ERR("failed to instantiate pixman images for band %zu", idx);
+        goto out;
+    }
+
+    pixman_image_set_transform(src, &job->transform);
+    pixman_image_set_filter(src, PIXMAN_FILTER_BEST, NULL, 0);
+
+    pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, dst,
+                             0, y, 0, 0, 0, 0, job->dst_width, height);
+
+out:
+    if (src != NULL)
+        pixman_image_unref(src);
+    if (dst != NULL)
+        pixman_image_unref(dst);
+}
+
+void
+scale_image(pixman_image_t *src, pixman_image_t *dst, bool stretch)
+{
+    const int src_width = pixman_image_get_width(src);
+    const int src_height = pixman_image_get_height(src);
+    const int width = pixman_image_get_width(dst);
+    const int height = pixman_image_get_height(dst);
+
+    double sx = (double)width / src_width;
+    double sy = (double)height / src_height;
+    double s = stretch ? fmax(sx, sy) : fmin(sx, sy);
+
+    struct scale_job job = {
+        .src_format = pixman_image_get_format(src),
+        .src_width = src_width,
+        .src_height = src_height,
+        .src_stride = pixman_image_get_stride(src),
+        .src_data = pixman_image_get_data(src),
+        .dst_format = pixman_image_get_format(dst),
+        .dst_width = width,
+        .dst_height = height,
+        .dst_stride = pixman_image_get_stride(dst),
+        .dst_data = (uint8_t *)pixman_image_get_data(dst),
+    };
+
+    pixman_transform_init_scale(
+        &job.transform, pixman_double_to_fixed(1/s), pixman_double_to_fixed(1/s));
+    pixman_transform_translate(&job.transform, NULL,
+        pixman_double_to_fixed((src_width - width / s) / 2),
+        pixman_double_to_fixed((src_height - height / s) / 2));
+
+    size_t band_count = thread_pool_size() * BANDS_PER_THREAD;
+    int band_height = (height + band_count - 1) / band_count;
+    if (band_height < MIN_BAND_HEIGHT)
+        band_height = MIN_BAND_HEIGHT;
+
+    job.band_height = band_height;
+    band_count = (height + band_height - 1) / band_height;
+
+    LOG_DBG("scaling %dx%d -> %dx%d in %zu bands of %d rows",
+            src_width, src_height, width, height, band_count, band_height);
+
+    thread_pool_run(&scale_band, &job, band_count);
+}
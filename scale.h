@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <pixman.h>
+
+/*
+ * Scales ‘src’ to fit (or, with ‘stretch’, to cover) all of ‘dst’,
+ * centered. The destination is split into horizontal bands, rendered
+ * in parallel on the thread pool.
+ */
+void scale_image(pixman_image_t *src, pixman_image_t *dst, bool stretch);
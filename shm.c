@@ -12,6 +12,7 @@
 #include <tllist.h>
 
 #define LOG_MODULE "shm"
+#define LOG_ENABLE_DBG 0
 #include "log.h"
 #include "stride.h"
 
@@ -23,20 +24,48 @@
  #define MFD_NOEXEC_SEAL 0
 #endif
 
+static tll(struct buffer) buffers;
+
 static void
 buffer_destroy(struct buffer *buf)
 {
     pixman_image_unref(buf->pix);
     wl_buffer_destroy(buf->wl_buf);
     munmap(buf->mmapped, buf->size);
-    free(buf);
+    close(buf->fd);
+}
+
+static void
+buffer_purge_if_unused(struct buffer *buffer)
+{
+    if (!buffer->purge || buffer->busy || buffer->refcount > 0)
+        return;
+
+    tll_foreach(buffers, it) {
+        if (&it->item == buffer) {
+            LOG_DBG("cookie=%lx: purging unused buffer %p (%dx%d)",
+                    buffer->cookie, (void *)buffer,
+                    buffer->width, buffer->height);
+            buffer_destroy(buffer);
+            tll_remove(buffers, it);
+            break;
+        }
+    }
 }
 
 static void
 buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
     struct buffer *buffer = data;
-    buffer_destroy(buffer);
+    assert(buffer->wl_buf == wl_buffer);
+
+    /*
+     * A buffer attached to multiple surfaces may be released more
+     * than once; it is not re-used until all outputs have dropped
+     * their references anyway.
+     */
+    buffer->busy = false;
+    buffer_purge_if_unused(buffer);
 }
 
 static const struct wl_buffer_listener buffer_listener = {
@@ -46,6 +75,45 @@ static const struct wl_buffer_listener buffer_listener = {
 struct buffer *
 shm_get_buffer(struct wl_shm *shm, int width, int height, unsigned long cookie)
 {
+    /* Re-use an idle buffer, if there is one with the right size */
+    tll_foreach(buffers, it) {
+        struct buffer *buf = &it->item;
+
+        if (buf->cookie != cookie || buf->busy || buf->purge ||
+            buf->refcount > 0)
+        {
+            continue;
+        }
+
+        if (buf->width == width && buf->height == height) {
+            LOG_DBG("cookie=%lx: re-using buffer %p (%dx%d)",
+                    cookie, (void *)buf, width, height);
+            buf->busy = true;
+            buf->attached = false;
+            buf->refcount = 1;
+            return buf;
+        }
+    }
+
+    /* Purge buffers with a stale size; busy ones once released */
+    tll_foreach(buffers, it) {
+        struct buffer *buf = &it->item;
+
+        if (buf->cookie != cookie)
+            continue;
+        if (buf->width == width && buf->height == height)
+            continue;
+
+        if (buf->busy || buf->refcount > 0)
+            buf->purge = true;
+        else {
+            LOG_DBG("cookie=%lx: purging buffer %p (%dx%d)",
+                    cookie, (void *)buf, buf->width, buf->height);
+            buffer_destroy(buf);
+            tll_remove(buffers, it);
+        }
+    }
+
     /*
      * 1. open a memory backed "file" with memfd_create()
      * 2. mmap() the memory file, to be used by the pixman image
@@ -121,7 +189,6 @@ shm_get_buffer(struct wl_shm *shm, int width, int height, unsigned long cookie)
 
     /* We use the entire pool for our single buffer */
     wl_shm_pool_destroy(pool); pool = NULL;
-    close(pool_fd); pool_fd = -1;
 
     pix = pixman_image_create_bits_no_clear(
         PIXMAN_x8r8g8b8, width, height, mmapped, stride);
@@ -130,20 +197,25 @@ shm_get_buffer(struct wl_shm *shm, int width, int height, unsigned long cookie)
         goto err;
     }
 
-    struct buffer *buffer = malloc(sizeof(*buffer));
-    *buffer = (struct buffer){
-        .width = width,
-        .height = height,
-        .stride = stride,
-        .cookie = cookie,
-        .busy = true,
-        .size = size,
-        .mmapped = mmapped,
-        .wl_buf = buf,
-        .pix = pix,
-    };
+    tll_push_back(
+        buffers, ((struct buffer){
+            .width = width,
+            .height = height,
+            .stride = stride,
+            .cookie = cookie,
+            .busy = true,
+            .refcount = 1,
+            .size = size,
+            .mmapped = mmapped,
+            .fd = pool_fd,
+            .wl_buf = buf,
+            .pix = pix}));
 
+    struct buffer *buffer = &tll_back(buffers);
     wl_buffer_add_listener(buffer->wl_buf, &buffer_listener, buffer);
+
+    LOG_DBG("cookie=%lx: allocated buffer %p (%dx%d), %zu buffers in total",
+            cookie, (void *)buffer, width, height, tll_length(buffers));
     return buffer;
 
 err:
@@ -160,3 +232,109 @@ err:
 
     return NULL;
 }
+
+static bool
+buffer_fill_from_file(struct buffer *buf, int fd, off_t offset)
+{
+    off_t src_offset = offset;
+    loff_t dst_offset = 0;
+    size_t left = buf->size;
+
+    /* Copied by the kernel, without going through our mapping */
+    while (left > 0) {
+        ssize_t ret = copy_file_range(
+            fd, &src_offset, buf->fd, &dst_offset, left, 0);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+
+        left -= ret;
+    }
+
+    /* Not supported across file systems by all kernels; read instead */
+    while (left > 0) {
+        ssize_t ret = pread(
+            fd, (uint8_t *)buf->mmapped + dst_offset, left, src_offset);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            LOG_ERRNO("failed to read buffer contents");
+            return false;
+        }
+        if (ret == 0) {
+            LOG_ERR("failed to read buffer contents: unexpected end of file");
+            return false;
+        }
+
+        src_offset += ret;
+        dst_offset += ret;
+        left -= ret;
+    }
+
+    return true;
+}
+
+struct buffer *
+shm_get_buffer_from_file(struct wl_shm *shm, int width, int height,
+                         unsigned long cookie, int fd, off_t offset)
+{
+    struct buffer *buf = shm_get_buffer(shm, width, height, cookie);
+    if (buf == NULL)
+        return NULL;
+
+    if (!buffer_fill_from_file(buf, fd, offset)) {
+        shm_buffer_unref(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+void
+shm_buffer_ref(struct buffer *buf)
+{
+    buf->refcount++;
+}
+
+void
+shm_buffer_unref(struct buffer *buf)
+{
+    assert(buf->refcount > 0);
+    buf->refcount--;
+
+    /* Never attached; the compositor will not release it */
+    if (buf->refcount == 0 && !buf->attached)
+        buf->busy = false;
+
+    buffer_purge_if_unused(buf);
+}
+
+void
+shm_purge(unsigned long cookie)
+{
+    tll_foreach(buffers, it) {
+        struct buffer *buf = &it->item;
+
+        if (buf->cookie != cookie)
+            continue;
+
+        if (buf->busy || buf->refcount > 0)
+            buf->purge = true;
+        else {
+            buffer_destroy(buf);
+            tll_remove(buffers, it);
+        }
+    }
+}
+
+void
+shm_fini(void)
+{
+    tll_foreach(buffers, it) {
+        buffer_destroy(&it->item);
+        tll_remove(buffers, it);
+    }
+}
@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include <sys/types.h>
+
 #include <pixman.h>
 #include <wayland-client.h>
 
@@ -13,12 +15,39 @@ struct buffer {
     unsigned long cookie;
 
     bool busy;
+    bool attached;  /* Set, with ‘busy’, by the owner when attaching */
     bool purge;
+    int refcount;
     size_t size;
     void *mmapped;
+    int fd;  /* Memory file backing ‘mmapped’ */
 
     struct wl_buffer *wl_buf;
     pixman_image_t *pix;
 };
 
+/*
+ * Returns an idle buffer from the pool of buffers belonging to
+ * ‘cookie’, allocating a new one if needed. The returned buffer holds
+ * one reference. It is returned to the pool once all references have
+ * been dropped, and the compositor has released it. Buffers never
+ * attached (see ‘attached’) are returned with the last reference.
+ */
 struct buffer *shm_get_buffer(struct wl_shm *shm, int width, int height, unsigned long cookie);
+
+/*
+ * Like shm_get_buffer(), but fills the buffer with ‘stride * height’
+ * bytes read from ‘fd’, starting at ‘offset’. Returns NULL if the
+ * file could not be read.
+ */
+struct buffer *shm_get_buffer_from_file(
+    struct wl_shm *shm, int width, int height, unsigned long cookie,
+    int fd, off_t offset);
+
+/* Takes an additional reference, e.g. before attaching to another surface */
+void shm_buffer_ref(struct buffer *buf);
+void shm_buffer_unref(struct buffer *buf);
+
+/* Destroys all buffers belonging to ‘cookie’ (busy ones once unused) */
+void shm_purge(unsigned long cookie);
+void shm_fini(void);
@@ -0,0 +1,137 @@
+#include "slideshow.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#define LOG_MODULE "slideshow"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "image.h"
+
+static char **paths = NULL;
+static size_t path_count = 0;
+
+static int
+path_compare(const void *a, const void *b)
+{
+    return strcoll(*(char *const *)a, *(char *const *)b);
+}
+
+/* Opens the file, if it is a regular file in a known image format */
+static bool
+is_image(int dir_fd, const char *name, const char *path)
+{
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_DBG("%s: failed to open", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    FILE *fp = fdopen(fd, "rb");
+    if (fp == NULL) {
+        close(fd);
+        return false;
+    }
+
+    const enum image_format format = image_probe(fp, path);
+    fclose(fp);
+
+    LOG_DBG("%s: %s", path, image_format_name(format));
+    return format != IMAGE_FORMAT_UNKNOWN;
+}
+
+bool
+slideshow_init(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        LOG_ERRNO("%s: failed to open directory", dir);
+        return false;
+    }
+
+    const size_t dir_len = strlen(dir);
+    const bool has_slash = dir_len > 0 && dir[dir_len - 1] == '/';
+    size_t capacity = 0;
+
+    errno = 0;
+    for (const struct dirent *e = readdir(d); e != NULL; errno = 0, e = readdir(d)) {
+        /* Skips ‘.’, ‘..’, and hidden files */
+        if (e->d_name[0] == '.')
+            continue;
+
+        char *path = malloc(dir_len + 1 + strlen(e->d_name) + 1);
+        if (path == NULL)
+            break;
+
+        sprintf(path, "%s%s%s", dir, has_slash ? "" : "/", e->d_name);
+
+        if (!is_image(dirfd(d), e->d_name, path)) {
+            free(path);
+            continue;
+        }
+
+        if (path_count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            char **new_paths = realloc(paths, capacity * sizeof(paths[0]));
+            if (new_paths == NULL) {
+                free(path);
+                break;
+            }
+            paths = new_paths;
+        }
+
+        paths[path_count++] = path;
+    }
+
+    if (errno != 0)
+        LOG_ERRNO("%s: failed to read directory", dir);
+
+    closedir(d);
+
+    if (path_count == 0) {
+        LOG_ERR("%s: no images", dir);
+        slideshow_fini();
+        return false;
+    }
+
+    qsort(paths, path_count, sizeof(paths[0]), &path_compare);
+
+    LOG_INFO("%s: %zu images", dir, path_count);
+    return true;
+}
+
+void
+slideshow_fini(void)
+{
+    for (size_t i = 0; i < path_count; i++)
+        free(paths[i]);
+    free(paths);
+
+    paths = NULL;
+    path_count = 0;
+}
+
+size_t
+slideshow_count(void)
+{
+    return path_count;
+}
+
+const char *
+slideshow_path(size_t idx)
+{
+    return path_count > 0 ? paths[idx % path_count] : NULL;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * --dir: the images in a directory, in name order. Only files in a
+ * recognized image format are included. Returns false if the
+ * directory cannot be read, or has no images.
+ */
+bool slideshow_init(const char *dir);
+void slideshow_fini(void);
+
+size_t slideshow_count(void);
+
+/* Path of image number ‘idx’, wrapping around */
+const char *slideshow_path(size_t idx);
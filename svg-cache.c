@@ -0,0 +1,521 @@
+#include "svg-cache.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_MODULE "svg-cache"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "cache.h"
+
+/*
+ * File layout, in host byte order:
+ *
+ *   header
+ *   shapes[shape_count]
+ *   paths[path_count]
+ *   gradients[gradient_count]
+ *   stops[stop_count]
+ *   points[point_count]   (x,y pairs of cubic bezier points)
+ *
+ * All records are multiples of 8 bytes, keeping every section aligned.
+ * Bump CACHE_VERSION whenever the layout, or the parse parameters used
+ * by svg.c, change.
+ */
+/* Upper limit of disk space used by cached images */
+#define SVG_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+#define CACHE_MAGIC "wbg-svg"
+#define CACHE_VERSION 1
+#define CACHE_BYTE_ORDER 0x01020304u
+
+struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t hash;
+    uint64_t source_size;
+    float width;
+    float height;
+    uint32_t shape_count;
+    uint32_t path_count;
+    uint32_t gradient_count;
+    uint32_t stop_count;
+    uint64_t point_count;
+};
+
+struct file_paint {
+    int32_t type;
+    uint32_t value;  /* Color, or gradient index */
+};
+
+struct file_shape {
+    struct file_paint fill;
+    struct file_paint stroke;
+    float opacity;
+    float stroke_width;
+    float stroke_dash_offset;
+    float stroke_dash_array[8];
+    float miter_limit;
+    float bounds[4];
+    float xform[6];
+    uint32_t first_path;
+    uint32_t path_count;
+    uint8_t stroke_dash_count;
+    uint8_t stroke_line_join;
+    uint8_t stroke_line_cap;
+    uint8_t fill_rule;
+    uint8_t flags;
+    uint8_t pad[3];
+};
+
+struct file_path {
+    uint64_t first_point;
+    uint32_t point_count;
+    uint8_t closed;
+    uint8_t pad[3];
+    float bounds[4];
+};
+
+struct file_gradient {
+    float xform[6];
+    float fx;
+    float fy;
+    uint32_t first_stop;
+    uint32_t stop_count;
+    uint8_t spread;
+    uint8_t pad[7];
+};
+
+struct file_stop {
+    uint32_t color;
+    float offset;
+};
+
+_Static_assert(sizeof(struct file_header) % 8 == 0, "misaligned header");
+_Static_assert(sizeof(struct file_shape) % 8 == 0, "misaligned shape");
+_Static_assert(sizeof(struct file_path) % 8 == 0, "misaligned path");
+_Static_assert(sizeof(struct file_gradient) % 8 == 0, "misaligned gradient");
+_Static_assert(sizeof(struct file_stop) % 8 == 0, "misaligned stop");
+
+/* A loaded image, and the cache file its points live in */
+struct cached_image {
+    NSVGimage image;  /* Must be first */
+    void *map;
+    size_t map_size;
+};
+
+static void
+init_paint(NSVGpaint *paint, const struct file_paint *p,
+           NSVGgradient *const *gradients)
+{
+    paint->type = p->type;
+
+    switch (p->type) {
+    case NSVG_PAINT_LINEAR_GRADIENT:
+    case NSVG_PAINT_RADIAL_GRADIENT:
+        paint->gradient = gradients[p->value];
+        break;
+
+    default:
+        paint->color = p->value;
+        break;
+    }
+}
+
+static bool
+paint_valid(const struct file_paint *p, uint32_t gradient_count)
+{
+    switch (p->type) {
+    case NSVG_PAINT_LINEAR_GRADIENT:
+    case NSVG_PAINT_RADIAL_GRADIENT:
+        return p->value < gradient_count;
+
+    default:
+        return true;
+    }
+}
+
+static size_t
+align_gradient(size_t size)
+{
+    return (size + alignof(NSVGgradient) - 1) & ~(alignof(NSVGgradient) - 1);
+}
+
+/* NSVGgradient ends with a one-element array of stops */
+static size_t
+gradient_size(uint32_t stop_count)
+{
+    return align_gradient(
+        sizeof(NSVGgradient) +
+        (stop_count > 1 ? stop_count - 1 : 0) * sizeof(NSVGgradientStop));
+}
+
+NSVGimage *
+svg_cache_load(const uint8_t *data, size_t size)
+{
+    const uint64_t hash = cache_hash(data, size, 0);
+    char path[PATH_MAX];
+
+    if (!cache_path(path, sizeof(path), "svg", hash, false))
+        return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_DBG("%s: not cached", path);
+        return NULL;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    struct cached_image *cached = NULL;
+    NSVGgradient **gradients = NULL;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct file_header))
+        goto err;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto err;
+
+    const struct file_header *hdr = map;
+
+    if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != CACHE_VERSION ||
+        hdr->byte_order != CACHE_BYTE_ORDER ||
+        hdr->hash != hash ||
+        hdr->source_size != size)
+    {
+        LOG_DBG("%s: stale or incompatible cache file", path);
+        goto err;
+    }
+
+    /* Counts are 32-bit, and there can't be more points than bytes;
+     * the sizes below can't overflow */
+    if (hdr->point_count > (uint64_t)st.st_size)
+        goto corrupt;
+
+    const uint64_t expected_size =
+        sizeof(*hdr) +
+        (uint64_t)hdr->shape_count * sizeof(struct file_shape) +
+        (uint64_t)hdr->path_count * sizeof(struct file_path) +
+        (uint64_t)hdr->gradient_count * sizeof(struct file_gradient) +
+        (uint64_t)hdr->stop_count * sizeof(struct file_stop) +
+        hdr->point_count * sizeof(float);
+
+    if (expected_size != (uint64_t)st.st_size)
+        goto corrupt;
+
+    const struct file_shape *shapes = (const void *)(hdr + 1);
+    const struct file_path *paths = (const void *)(shapes + hdr->shape_count);
+    const struct file_gradient *grads = (const void *)(paths + hdr->path_count);
+    const struct file_stop *stops = (const void *)(grads + hdr->gradient_count);
+    const float *points = (const void *)(stops + hdr->stop_count);
+
+    /* Gradients are variable sized, and go last in our allocation */
+    const size_t grads_offset = align_gradient(
+        sizeof(*cached) +
+        (size_t)hdr->shape_count * sizeof(NSVGshape) +
+        (size_t)hdr->path_count * sizeof(NSVGpath));
+    size_t alloc_size = grads_offset;
+
+    /* Validate all indices before building anything */
+    for (uint32_t i = 0; i < hdr->shape_count; i++) {
+        const struct file_shape *s = &shapes[i];
+        if ((uint64_t)s->first_path + s->path_count > hdr->path_count ||
+            !paint_valid(&s->fill, hdr->gradient_count) ||
+            !paint_valid(&s->stroke, hdr->gradient_count))
+        {
+            goto corrupt;
+        }
+    }
+
+    for (uint32_t i = 0; i < hdr->path_count; i++) {
+        const struct file_path *p = &paths[i];
+        if (p->first_point > hdr->point_count ||
+            (uint64_t)p->point_count * 2 > hdr->point_count - p->first_point)
+        {
+            goto corrupt;
+        }
+    }
+
+    for (uint32_t i = 0; i < hdr->gradient_count; i++) {
+        const struct file_gradient *g = &grads[i];
+        if ((uint64_t)g->first_stop + g->stop_count > hdr->stop_count)
+            goto corrupt;
+        alloc_size += gradient_size(g->stop_count);
+    }
+
+    /* One allocation for the image, and all shapes, paths and gradients */
+    if ((cached = calloc(1, alloc_size)) == NULL)
+        goto err;
+    if (hdr->gradient_count > 0 &&
+        (gradients = calloc(hdr->gradient_count, sizeof(gradients[0]))) == NULL)
+    {
+        goto err;
+    }
+
+    NSVGshape *nshapes = (NSVGshape *)(cached + 1);
+    NSVGpath *npaths = (NSVGpath *)(nshapes + hdr->shape_count);
+    uint8_t *ngrads = (uint8_t *)cached + grads_offset;
+
+    for (uint32_t i = 0; i < hdr->gradient_count; i++) {
+        const struct file_gradient *g = &grads[i];
+        NSVGgradient *ng = (NSVGgradient *)ngrads;
+
+        memcpy(ng->xform, g->xform, sizeof(ng->xform));
+        ng->spread = g->spread;
+        ng->fx = g->fx;
+        ng->fy = g->fy;
+        ng->nstops = g->stop_count;
+
+        for (uint32_t j = 0; j < g->stop_count; j++) {
+            ng->stops[j].color = stops[g->first_stop + j].color;
+            ng->stops[j].offset = stops[g->first_stop + j].offset;
+        }
+
+        gradients[i] = ng;
+        ngrads += gradient_size(g->stop_count);
+    }
+
+    for (uint32_t i = 0; i < hdr->path_count; i++) {
+        const struct file_path *p = &paths[i];
+        NSVGpath *np = &npaths[i];
+
+        /* Rasterizer only reads the points; use them in place */
+        np->pts = (float *)&points[p->first_point];
+        np->npts = p->point_count;
+        np->closed = p->closed;
+        memcpy(np->bounds, p->bounds, sizeof(np->bounds));
+    }
+
+    for (uint32_t i = 0; i < hdr->shape_count; i++) {
+        const struct file_shape *s = &shapes[i];
+        NSVGshape *ns = &nshapes[i];
+
+        init_paint(&ns->fill, &s->fill, gradients);
+        init_paint(&ns->stroke, &s->stroke, gradients);
+        ns->opacity = s->opacity;
+        ns->strokeWidth = s->stroke_width;
+        ns->strokeDashOffset = s->stroke_dash_offset;
+        memcpy(ns->strokeDashArray, s->stroke_dash_array, sizeof(ns->strokeDashArray));
+        ns->strokeDashCount = s->stroke_dash_count;
+        ns->strokeLineJoin = s->stroke_line_join;
+        ns->strokeLineCap = s->stroke_line_cap;
+        ns->miterLimit = s->miter_limit;
+        ns->fillRule = s->fill_rule;
+        ns->flags = s->flags;
+        memcpy(ns->bounds, s->bounds, sizeof(ns->bounds));
+        memcpy(ns->xform, s->xform, sizeof(ns->xform));
+
+        for (uint32_t j = 0; j < s->path_count; j++) {
+            NSVGpath *np = &npaths[s->first_path + j];
+            np->next = j + 1 < s->path_count ? np + 1 : NULL;
+        }
+
+        ns->paths = s->path_count > 0 ? &npaths[s->first_path] : NULL;
+        ns->next = i + 1 < hdr->shape_count ? ns + 1 : NULL;
+    }
+
+    cached->image.width = hdr->width;
+    cached->image.height = hdr->height;
+    cached->image.shapes = hdr->shape_count > 0 ? nshapes : NULL;
+    cached->map = map;
+    cached->map_size = st.st_size;
+
+    LOG_DBG("%s: loaded %u shapes, %u paths, %" PRIu64 " points",
+            path, hdr->shape_count, hdr->path_count, hdr->point_count / 2);
+
+    /* Pruning removes the least recently *used* images */
+    futimens(fd, NULL);
+
+    free(gradients);
+    close(fd);
+    return &cached->image;
+
+corrupt:
+    LOG_WARN("%s: corrupt cache file", path);
+
+err:
+    free(gradients);
+    free(cached);
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+    close(fd);
+    return NULL;
+}
+
+static void
+write_paint(struct file_paint *p, const NSVGpaint *paint, uint32_t *gradient_idx)
+{
+    p->type = paint->type;
+
+    switch (paint->type) {
+    case NSVG_PAINT_LINEAR_GRADIENT:
+    case NSVG_PAINT_RADIAL_GRADIENT:
+        p->value = (*gradient_idx)++;
+        break;
+
+    default:
+        p->value = paint->color;
+        break;
+    }
+}
+
+static void
+write_gradient(struct file_gradient *g, struct file_stop *stops,
+               uint32_t *stop_idx, const NSVGgradient *gradient)
+{
+    memcpy(g->xform, gradient->xform, sizeof(g->xform));
+    g->fx = gradient->fx;
+    g->fy = gradient->fy;
+    g->spread = gradient->spread;
+    g->first_stop = *stop_idx;
+    g->stop_count = gradient->nstops;
+
+    for (int i = 0; i < gradient->nstops; i++) {
+        stops[*stop_idx].color = gradient->stops[i].color;
+        stops[*stop_idx].offset = gradient->stops[i].offset;
+        (*stop_idx)++;
+    }
+}
+
+static bool
+is_gradient(const NSVGpaint *paint)
+{
+    return paint->type == NSVG_PAINT_LINEAR_GRADIENT ||
+        paint->type == NSVG_PAINT_RADIAL_GRADIENT;
+}
+
+void
+svg_cache_store(const uint8_t *data, size_t size, const NSVGimage *image)
+{
+    const uint64_t hash = cache_hash(data, size, 0);
+    char path[PATH_MAX];
+
+    if (!cache_path(path, sizeof(path), "svg", hash, true))
+        return;
+
+    struct file_header hdr = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .byte_order = CACHE_BYTE_ORDER,
+        .hash = hash,
+        .source_size = size,
+        .width = image->width,
+        .height = image->height,
+    };
+
+    /* Pass 1: count */
+    for (const NSVGshape *s = image->shapes; s != NULL; s = s->next) {
+        hdr.shape_count++;
+
+        const NSVGpaint *paints[] = {&s->fill, &s->stroke};
+        for (size_t i = 0; i < 2; i++) {
+            if (is_gradient(paints[i])) {
+                hdr.gradient_count++;
+                hdr.stop_count += paints[i]->gradient->nstops;
+            }
+        }
+
+        for (const NSVGpath *p = s->paths; p != NULL; p = p->next) {
+            hdr.path_count++;
+            hdr.point_count += (uint64_t)p->npts * 2;
+        }
+    }
+
+    const size_t file_size =
+        sizeof(hdr) +
+        (size_t)hdr.shape_count * sizeof(struct file_shape) +
+        (size_t)hdr.path_count * sizeof(struct file_path) +
+        (size_t)hdr.gradient_count * sizeof(struct file_gradient) +
+        (size_t)hdr.stop_count * sizeof(struct file_stop) +
+        (size_t)hdr.point_count * sizeof(float);
+
+    uint8_t *buf = calloc(1, file_size);
+    if (buf == NULL)
+        return;
+
+    struct file_shape *shapes = (void *)(buf + sizeof(hdr));
+    struct file_path *paths = (void *)(shapes + hdr.shape_count);
+    struct file_gradient *grads = (void *)(paths + hdr.path_count);
+    struct file_stop *stops = (void *)(grads + hdr.gradient_count);
+    float *points = (void *)(stops + hdr.stop_count);
+
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    /* Pass 2: flatten */
+    uint32_t shape_idx = 0, path_idx = 0, gradient_idx = 0, stop_idx = 0;
+    uint64_t point_idx = 0;
+
+    for (const NSVGshape *s = image->shapes; s != NULL; s = s->next) {
+        struct file_shape *fs = &shapes[shape_idx++];
+
+        if (is_gradient(&s->fill))
+            write_gradient(&grads[gradient_idx], stops, &stop_idx, s->fill.gradient);
+        write_paint(&fs->fill, &s->fill, &gradient_idx);
+
+        if (is_gradient(&s->stroke))
+            write_gradient(&grads[gradient_idx], stops, &stop_idx, s->stroke.gradient);
+        write_paint(&fs->stroke, &s->stroke, &gradient_idx);
+
+        fs->opacity = s->opacity;
+        fs->stroke_width = s->strokeWidth;
+        fs->stroke_dash_offset = s->strokeDashOffset;
+        memcpy(fs->stroke_dash_array, s->strokeDashArray, sizeof(fs->stroke_dash_array));
+        fs->stroke_dash_count = s->strokeDashCount;
+        fs->stroke_line_join = s->strokeLineJoin;
+        fs->stroke_line_cap = s->strokeLineCap;
+        fs->miter_limit = s->miterLimit;
+        fs->fill_rule = s->fillRule;
+        fs->flags = s->flags;
+        memcpy(fs->bounds, s->bounds, sizeof(fs->bounds));
+        memcpy(fs->xform, s->xform, sizeof(fs->xform));
+        fs->first_path = path_idx;
+
+        for (const NSVGpath *p = s->paths; p != NULL; p = p->next) {
+            struct file_path *fp = &paths[path_idx++];
+
+            fp->first_point = point_idx;
+            fp->point_count = p->npts;
+            fp->closed = p->closed;
+            memcpy(fp->bounds, p->bounds, sizeof(fp->bounds));
+
+            memcpy(&points[point_idx], p->pts, (size_t)p->npts * 2 * sizeof(float));
+            point_idx += (uint64_t)p->npts * 2;
+        }
+
+        fs->path_count = path_idx - fs->first_path;
+    }
+
+    const struct iovec iov = {.iov_base = buf, .iov_len = file_size};
+    if (cache_write(path, &iov, 1)) {
+        LOG_DBG("%s: stored %u shapes, %u paths, %" PRIu64 " points",
+                path, hdr.shape_count, hdr.path_count, hdr.point_count / 2);
+        cache_prune("svg", SVG_CACHE_MAX_SIZE);
+    }
+
+    free(buf);
+}
+
+void
+svg_cache_free(NSVGimage *image)
+{
+    struct cached_image *cached = (struct cached_image *)image;
+
+    if (cached == NULL)
+        return;
+
+    munmap(cached->map, cached->map_size);
+    free(cached);
+}
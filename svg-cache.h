@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <nanosvg/nanosvg.h>
+
+/*
+ * On-disk cache of parsed SVG images, in $XDG_CACHE_HOME/wbg, keyed
+ * by a hash of the SVG file's content.
+ *
+ * Images returned by svg_cache_load() point into the mapped cache
+ * file; free them with svg_cache_free(), not nsvgDelete().
+ */
+NSVGimage *svg_cache_load(const uint8_t *data, size_t size);
+void svg_cache_store(const uint8_t *data, size_t size, const NSVGimage *image);
+void svg_cache_free(NSVGimage *image);
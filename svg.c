@@ -2,95 +2,296 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <nanosvg/nanosvgrast.h>
 
 #define LOG_MODULE "svg"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
+#include "image.h"
+#include "premultiply.h"
 #include "stride.h"
+#include "svg-cache.h"
+#include "thread-pool.h"
+
+/* Minimum number of rows in a band */
+#define MIN_BAND_HEIGHT 32
+
+/* Bands per thread; more than one evens out the load */
+#define BANDS_PER_THREAD 4
+
+struct rasterizers {
+    struct NSVGrasterizer *rast;
+
+#if defined(NSVG_HAVE_RASTERIZE_PREPARED)
+    /* One rasterizer per band, since they hold per-scanline state */
+    struct NSVGrasterizer **bands;
+    size_t band_count;
+#endif
+};
 
 struct NSVGimage *svg_image = NULL;
-struct NSVGrasterizer *rast = NULL;
+static struct rasterizers rasts;
 
-bool
-svg_load(FILE *fp, const char *path)
+/* svg_image points into the on-disk cache */
+static bool svg_image_cached = false;
+
+#if defined(NSVG_HAVE_RASTERIZE_PREPARED)
+struct svg_job {
+    const NSVGprepared *prepared;
+    struct NSVGrasterizer **rasts;
+    uint8_t *data;
+    int width;
+    int height;
+    int stride;
+    int band_height;
+};
+
+static void
+render_band(void *data, size_t idx)
 {
-    svg_image = nsvgParseFromFile(path, "px", 96);
-    if (svg_image == NULL)
+    const struct svg_job *job = data;
+    const int y = idx * job->band_height;
+
+    nsvgRasterizePrepared(
+        job->rasts[idx], job->prepared, job->data,
+        job->width, job->height, job->stride, y, y + job->band_height);
+}
+
+static bool
+ensure_band_rasterizers(struct rasterizers *r, size_t count)
+{
+    if (count <= r->band_count)
+        return true;
+
+    struct NSVGrasterizer **bands = realloc(r->bands, count * sizeof(bands[0]));
+    if (bands == NULL)
         return false;
-    if (svg_image->width == 0 || svg_image->height == 0) {
+
+    r->bands = bands;
+
+    for (; r->band_count < count; r->band_count++) {
+        if ((r->bands[r->band_count] = nsvgCreateRasterizer()) == NULL)
+            return false;
+    }
+
+    return true;
+}
+#endif
+
+static void
+rasterizers_free(struct rasterizers *r)
+{
+    if (r->rast != NULL)
+        nsvgDeleteRasterizer(r->rast);
+    r->rast = NULL;
+
+#if defined(NSVG_HAVE_RASTERIZE_PREPARED)
+    for (size_t i = 0; i < r->band_count; i++)
+        nsvgDeleteRasterizer(r->bands[i]);
+    free(r->bands);
+    r->bands = NULL;
+    r->band_count = 0;
+#endif
+}
+
+static void
+image_delete(struct NSVGimage *image, bool cached)
+{
+    if (cached)
+        svg_cache_free(image);
+    else
+        nsvgDelete(image);
+}
+
+static void
+svg_delete(void)
+{
+    if (svg_image == NULL)
+        return;
+
+    image_delete(svg_image, svg_image_cached);
+    svg_image = NULL;
+    svg_image_cached = false;
+}
+
+/* Parses the file, or loads it from the cache; ‘cached’ says which */
+static struct NSVGimage *
+parse(FILE *fp, const char *path, bool *cached)
+{
+    size_t size;
+    const uint8_t *data = image_map_file(fp, path, &size);
+    if (data == NULL)
+        return NULL;
+
+    struct NSVGimage *image;
+
+    /* Previously parsed, and cached, images skip parsing entirely */
+    if ((image = svg_cache_load(data, size)) != NULL) {
+        LOG_DBG("%s: loaded from cache", path);
+        *cached = true;
+    } else {
+        *cached = false;
+
+        /* nsvgParse() wants a mutable, NUL terminated string */
+        char *copy = malloc(size + 1);
+        if (copy != NULL) {
+            memcpy(copy, data, size);
+            copy[size] = '\0';
+            image = nsvgParse(copy, "px", 96);
+            free(copy);
+        }
+
+        if (image != NULL && image->width != 0 && image->height != 0)
+            svg_cache_store(data, size, image);
+    }
+
+    image_unmap_file(data, size);
+
+    if (image == NULL)
+        return NULL;
+    if (image->width == 0 || image->height == 0) {
         LOG_DBG("%s: width and/or heigth is zero, not a SVG?", path);
-        nsvgDelete(svg_image);
-        svg_image = NULL;
-        return false;
+        image_delete(image, *cached);
+        return NULL;
     }
-    rast = nsvgCreateRasterizer();
-    if (rast == NULL)
+    return image;
+}
+
+bool
+svg_load(FILE *fp, const char *path)
+{
+    svg_delete();
+
+    if ((svg_image = parse(fp, path, &svg_image_cached)) == NULL)
+        return false;
+    if (rasts.rast == NULL)
+        rasts.rast = nsvgCreateRasterizer();
+    if (rasts.rast == NULL)
         return false;
     return true;
 }
 
+static void
+render(struct NSVGimage *image, struct rasterizers *r,
+       pixman_image_t *dst, bool stretch)
+{
+    const int width = pixman_image_get_width(dst);
+    const int height = pixman_image_get_height(dst);
+    const int stride = pixman_image_get_stride(dst);
+    uint8_t *data = (uint8_t *)pixman_image_get_data(dst);
+
+    double sx = width / (double)image->width;
+    double sy = height / (double)image->height;
+    double s = stretch ? fmax(sx, sy) : fmin(sx, sy);
+
+    float tx = (width - image->width * s) / 2;
+    float ty = (height - image->height * s) / 2;
+
+#if defined(NSVG_HAVE_RASTERIZE_PREPARED)
+    /*
+     * Flatten once, then rasterize horizontal bands in parallel. Each
+     * band only reads the shared edges, and writes its own rows.
+     */
+    size_t band_count = thread_pool_size() * BANDS_PER_THREAD;
+    int band_height = (height + band_count - 1) / band_count;
+    if (band_height < MIN_BAND_HEIGHT)
+        band_height = MIN_BAND_HEIGHT;
+    band_count = (height + band_height - 1) / band_height;
+
+    NSVGprepared *prepared = NULL;
+
+    if (band_count > 1 &&
+        ensure_band_rasterizers(r, band_count) &&
+        (prepared = nsvgPrepare(r->rast, image, tx, ty, s, width, height, 1)) != NULL)
+    {
+        struct svg_job job = {
+            .prepared = prepared,
+            .rasts = r->bands,
+            .data = data,
+            .width = width,
+            .height = height,
+            .stride = stride,
+            .band_height = band_height,
+        };
+
+        LOG_DBG("rasterizing %dx%d in %zu bands of %d rows",
+                width, height, band_count, band_height);
+
+        thread_pool_run(&render_band, &job, band_count);
+        nsvgDeletePrepared(prepared);
+        return;
+    }
+#endif
+
+#if defined(NSVG_HAVE_RASTERIZE_PREMULTIPLIED_BGRA)
+    /* Pre-multiplied BGRA is our (little endian) ARGB; rasterize
+     * directly into the destination */
+    nsvgRasterizePremultipliedBGRA(
+        r->rast, image, tx, ty, s, data, width, height, stride);
+#else
+    /* Nanosvg produces non-premultiplied ABGR, while we use
+     * premultiplied ARGB */
+    nsvgRasterize(r->rast, image, tx, ty, s, data, width, height, stride);
+
+    for (int y = 0; y < height; y++)
+        premultiply((uint32_t *)&data[y * stride], width, true);
+#endif
+}
+
+void
+svg_render(pixman_image_t *dst, bool stretch)
+{
+    render(svg_image, &rasts, dst, stretch);
+}
+
 pixman_image_t *
-svg_render(const int width, const int height, bool stretch)
+svg_rasterize(FILE *fp, const char *path, const struct image_target *target)
 {
+    bool cached;
+    struct NSVGimage *image = parse(fp, path, &cached);
+    if (image == NULL)
+        return NULL;
+
+    struct rasterizers r = {.rast = nsvgCreateRasterizer()};
     pixman_image_t *pix = NULL;
-    uint8_t *data = NULL;
-    int stride = stride_for_format_and_width(PIXMAN_a8b8g8r8, width);
 
-    if (!(data = calloc(1, height * stride)))
-        return NULL;
+    if (r.rast == NULL)
+        goto out;
 
-    double sx = width / (double)svg_image->width;
-    double sy = height / (double)svg_image->height;
-    double s = stretch ? fmax(sx, sy) : fmin(sx, sy);
+    const double s = image_target_scale(target, image->width, image->height);
 
-    float tx = (width - svg_image->width * s) / 2;
-    float ty = (height - svg_image->height * s) / 2;
+    const int width = fmax(ceil(image->width * s), 1);
+    const int height = fmax(ceil(image->height * s), 1);
+    const int stride = stride_for_format_and_width(PIXMAN_a8r8g8b8, width);
 
-    nsvgRasterize(rast, svg_image, tx, ty, s, data, width, height, stride);
+    uint8_t *data = calloc(height, stride);
+    if (data == NULL)
+        goto out;
+
+    pix = pixman_image_create_bits_no_clear(
+        PIXMAN_a8r8g8b8, width, height, (uint32_t *)data, stride);
 
-    pix = pixman_image_create_bits_no_clear(PIXMAN_a8b8g8r8, width,
-        height, (uint32_t *)data, stride);
     if (pix == NULL) {
-        LOG_ERR("failed to render svg image");
         free(data);
-        return NULL;
+        goto out;
     }
 
-    /* Copied from fuzzel */
-    /* Nanosvg produces non-premultiplied ABGR, while pixman expects
-     * premultiplied */
-    for (uint32_t *abgr = (uint32_t *)data;
-         abgr < (uint32_t *)(data + (size_t)width * (size_t)height * 4);
-         abgr++) {
-        uint8_t alpha = (*abgr >> 24) & 0xff;
-        uint8_t blue = (*abgr >> 16) & 0xff;
-        uint8_t green = (*abgr >> 8) & 0xff;
-        uint8_t red = (*abgr >> 0) & 0xff;
-
-        if (alpha == 0xff)
-            continue;
-
-        if (alpha == 0x00)
-            blue = green = red = 0x00;
-        else {
-            blue = blue * alpha / 0xff;
-            green = green * alpha / 0xff;
-            red = red * alpha / 0xff;
-        }
+    LOG_DBG("%s: rasterizing %dx%d, for %dx%d", path, width, height,
+            target->width, target->height);
 
-        *abgr = (uint32_t)alpha << 24 | blue << 16 | green << 8 | red;
-    }
+    render(image, &r, pix, false);
 
+out:
+    rasterizers_free(&r);
+    image_delete(image, cached);
     return pix;
 }
 
 void
 svg_free()
 {
-    if (svg_image != NULL)
-        nsvgDelete(svg_image);
-    if (rast != NULL)
-        nsvgDeleteRasterizer(rast);
+    svg_delete();
+    rasterizers_free(&rasts);
 }
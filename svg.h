@@ -4,6 +4,20 @@
 #include <stdbool.h>
 #include <pixman.h>
 
+struct image_target;
+
 bool svg_load(FILE *fp, const char *path);
-pixman_image_t *svg_render(const int width, const int height, bool stretch);
+
+/* Rasterizes the image into ‘dst’ (32-bit ARGB or XRGB), replacing its content */
+void svg_render(pixman_image_t *dst, bool stretch);
+
+/*
+ * Loads, and rasterizes, ‘fp’ into a new (pre-multiplied ARGB) image,
+ * scaled as image_target_scale() says for ‘target’. Leaves the
+ * module's single image alone, and may be called from any thread. For
+ * callers that cannot keep an image loaded.
+ */
+pixman_image_t *svg_rasterize(FILE *fp, const char *path,
+                              const struct image_target *target);
+
 void svg_free();
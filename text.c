@@ -0,0 +1,57 @@
+#include "text.h"
+
+static void
+render_glyphs(struct fcft_font *font, pixman_image_t *dst,
+              int *x, const int *y, pixman_image_t *color,
+              size_t count, const struct fcft_glyph *glyphs[static count],
+              long *kern)
+{
+    for (size_t i = 0; i < count; i++) {
+        const struct fcft_glyph *g = glyphs[i];
+        if (g == NULL)
+            continue;
+
+        if (kern != NULL)
+            *x += kern[i];
+
+        if (pixman_image_get_format(g->pix) == PIXMAN_a8r8g8b8) {
+            pixman_image_composite32(
+                PIXMAN_OP_OVER, g->pix, NULL, dst, 0, 0, 0, 0,
+                *x + g->x, *y + font->ascent - g->y, g->width, g->height);
+        } else {
+            pixman_image_composite32(
+                PIXMAN_OP_OVER, color, g->pix, dst, 0, 0, 0, 0,
+                *x + g->x, *y + font->ascent - g->y, g->width, g->height);
+        }
+
+        *x += g->advance.x;
+    }
+}
+
+void
+text_render(struct fcft_font *font, enum fcft_subpixel subpixel,
+            const char32_t *text, size_t len,
+            pixman_image_t *dst, int y, pixman_image_t *color)
+{
+    const struct fcft_glyph *glyphs[len];
+    long kern[len];
+    int text_width = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        glyphs[i] = fcft_rasterize_char_utf32(font, text[i], subpixel);
+        if (glyphs[i] == NULL)
+            continue;
+
+        kern[i] = 0;
+        if (i > 0) {
+            long x_kern;
+            if (fcft_kerning(font, text[i - 1], text[i], &x_kern, NULL))
+                kern[i] = x_kern;
+        }
+
+        text_width += kern[i] + glyphs[i]->advance.x;
+    }
+
+    int x = (pixman_image_get_width(dst) - text_width) / 2;
+    render_glyphs(font, dst, &x, &y, color, len, glyphs, kern);
+}
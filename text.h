@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <uchar.h>
+
+#include <pixman.h>
+#include <fcft/fcft.h>
+
+/*
+ * Renders ‘text’, horizontally centered in ‘dst’, with the top of the
+ * line at row ‘y’. ‘color’ fills glyphs that aren't color glyphs
+ * (e.g. emoji) themselves.
+ */
+void text_render(struct fcft_font *font, enum fcft_subpixel subpixel,
+                 const char32_t *text, size_t len,
+                 pixman_image_t *dst, int y, pixman_image_t *color);
@@ -0,0 +1,164 @@
+#include "thread-pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_MODULE "thread-pool"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+static pthread_t *workers = NULL;
+static size_t worker_count = 0;
+
+/* Serializes concurrent callers of thread_pool_run() */
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* See thread_pool_set_serial() */
+static _Thread_local bool serial = false;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool quit = false;
+
+static struct {
+    thread_pool_job_t job;
+    void *data;
+    size_t count;
+    size_t next;
+    size_t done;
+} current;
+
+static void *
+worker_thread(void *arg)
+{
+    pthread_mutex_lock(&lock);
+
+    while (true) {
+        while (!quit && current.next >= current.count)
+            pthread_cond_wait(&work_cond, &lock);
+
+        if (quit)
+            break;
+
+        const size_t idx = current.next++;
+        thread_pool_job_t job = current.job;
+        void *data = current.data;
+
+        pthread_mutex_unlock(&lock);
+        job(data, idx);
+        pthread_mutex_lock(&lock);
+
+        if (++current.done == current.count)
+            pthread_cond_signal(&done_cond);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static size_t
+cpu_count(void)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return CPU_COUNT(&set);
+
+    LOG_ERRNO("failed to get CPU affinity mask");
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+}
+
+bool
+thread_pool_init(size_t count)
+{
+    if (count == 0)
+        count = cpu_count();
+
+    workers = calloc(count - 1, sizeof(workers[0]));
+    if (count > 1 && workers == NULL) {
+        LOG_ERRNO("failed to allocate worker threads");
+        return false;
+    }
+
+    for (size_t i = 0; i < count - 1; i++) {
+        int ret = pthread_create(&workers[i], NULL, &worker_thread, NULL);
+        if (ret != 0) {
+            LOG_ERRNO_P("failed to create worker thread", ret);
+            break;
+        }
+        worker_count++;
+    }
+
+    LOG_DBG("using %zu render threads", worker_count + 1);
+    return true;
+}
+
+void
+thread_pool_fini(void)
+{
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&lock);
+
+    for (size_t i = 0; i < worker_count; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+}
+
+size_t
+thread_pool_size(void)
+{
+    return serial ? 1 : worker_count + 1;
+}
+
+void
+thread_pool_set_serial(void)
+{
+    serial = true;
+}
+
+void
+thread_pool_run(thread_pool_job_t job, void *data, size_t count)
+{
+    if (serial || worker_count == 0 || count <= 1) {
+        for (size_t i = 0; i < count; i++)
+            job(data, i);
+        return;
+    }
+
+    pthread_mutex_lock(&run_lock);
+    pthread_mutex_lock(&lock);
+
+    current.job = job;
+    current.data = data;
+    current.count = count;
+    current.next = 0;
+    current.done = 0;
+    pthread_cond_broadcast(&work_cond);
+
+    /* Help out while waiting */
+    while (current.next < current.count) {
+        const size_t idx = current.next++;
+
+        pthread_mutex_unlock(&lock);
+        job(data, idx);
+        pthread_mutex_lock(&lock);
+
+        current.done++;
+    }
+
+    while (current.done < current.count)
+        pthread_cond_wait(&done_cond, &lock);
+
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&run_lock);
+}
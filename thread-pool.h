@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*thread_pool_job_t)(void *data, size_t idx);
+
+/*
+ * Spawns the worker threads. A ‘count’ of 0 uses one thread per CPU
+ * in the process’ affinity mask. The calling thread counts as one of
+ * the threads.
+ */
+bool thread_pool_init(size_t count);
+void thread_pool_fini(void);
+
+/* Total number of threads, including the caller of thread_pool_run() */
+size_t thread_pool_size(void);
+
+/*
+ * Makes thread_pool_run() run all jobs on the calling thread itself,
+ * without taking the pool, and thread_pool_size() return 1, for the
+ * rest of that thread's life. For background threads, which must
+ * never make the main thread wait for the pool.
+ */
+void thread_pool_set_serial(void);
+
+/*
+ * Calls ‘job’ once for each index in [0, count), spread out over the
+ * worker threads and the calling thread, and waits for all of them to
+ * finish.
+ */
+void thread_pool_run(thread_pool_job_t job, void *data, size_t count);
@@ -0,0 +1,140 @@
+#include "timings.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#define LOG_MODULE "timings"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+/* Phases beyond this are dropped */
+#define MAX_PHASES 128
+
+struct phase {
+    char name[64];
+    uint64_t start;
+    uint64_t end;
+};
+
+static bool enabled = false;
+static uint64_t origin;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct phase phases[MAX_PHASES];
+static size_t phase_count = 0;
+static size_t dropped = 0;
+
+void
+timings_enable(void)
+{
+    origin = timings_now();
+    enabled = true;
+}
+
+bool
+timings_enabled(void)
+{
+    return enabled;
+}
+
+uint64_t
+timings_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+timings_record(uint64_t start, const char *fmt, ...)
+{
+    if (!enabled)
+        return;
+
+    const uint64_t end = timings_now();
+
+    pthread_mutex_lock(&lock);
+
+    if (phase_count >= MAX_PHASES)
+        dropped++;
+    else {
+        struct phase *p = &phases[phase_count++];
+        p->start = start;
+        p->end = end;
+
+        va_list va;
+        va_start(va, fmt);
+        vsnprintf(p->name, sizeof(p->name), fmt, va);
+        va_end(va);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static double
+ms(uint64_t ns)
+{
+    return ns / 1000000.;
+}
+
+static void
+print_json_string(const char *s)
+{
+    fputc('"', stderr);
+    for (; *s != '\0'; s++) {
+        const unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(stderr, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(stderr, "\\u%04x", c);
+        else
+            fputc(c, stderr);
+    }
+    fputc('"', stderr);
+}
+
+void
+timings_report(void)
+{
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    /* Phases are recorded as they end; list them in start order */
+    for (size_t i = 1; i < phase_count; i++) {
+        struct phase p = phases[i];
+        size_t j = i;
+        for (; j > 0 && phases[j - 1].start > p.start; j--)
+            phases[j] = phases[j - 1];
+        phases[j] = p;
+    }
+
+    fprintf(stderr, "%-40s %12s %12s\n", "phase", "start (ms)", "time (ms)");
+
+    for (size_t i = 0; i < phase_count; i++) {
+        const struct phase *p = &phases[i];
+        fprintf(stderr, "%-40s %12.3f %12.3f\n",
+                p->name, ms(p->start - origin), ms(p->end - p->start));
+    }
+
+    if (dropped > 0)
+        LOG_WARN("%zu phases not recorded", dropped);
+
+    fprintf(stderr, "{\"timings\":[");
+
+    for (size_t i = 0; i < phase_count; i++) {
+        const struct phase *p = &phases[i];
+
+        fprintf(stderr, "%s{\"phase\":", i > 0 ? "," : "");
+        print_json_string(p->name);
+        fprintf(stderr, ",\"start_ms\":%.3f,\"duration_ms\":%.3f}",
+                ms(p->start - origin), ms(p->end - p->start));
+    }
+
+    fprintf(stderr, "]}\n");
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Startup phase timings, for --timings. Recording is thread safe, and
+ * a no-op unless enabled.
+ */
+void timings_enable(void);
+bool timings_enabled(void);
+
+/* Monotonic time, in nanoseconds */
+uint64_t timings_now(void);
+
+/* Records a phase that started at ‘start’ (see timings_now()), and
+ * ended now */
+void timings_record(uint64_t start, const char *fmt, ...)
+    __attribute__((format (printf, 2, 3)));
+
+/* Prints a table, followed by a single line of JSON, to stderr */
+void timings_report(void);
@@ -1,4 +1,5 @@
 #include "webp.h"
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -10,73 +11,102 @@
 #include "stride.h"
 
 pixman_image_t *
-webp_load(FILE *fp, const char *path)
+webp_load(FILE *fp, const char *path, const struct image_target *target,
+          bool *reduced)
 {
-    uint8_t *file_data = NULL;
+    const uint8_t *file_data = NULL;
     uint8_t *image_data = NULL;
-    size_t image_size;
+    size_t file_size = 0;
     bool ok = false;
     pixman_image_t *pix = NULL;
     pixman_format_code_t format;
     int width, height, stride;
 
-    if (fseek(fp, 0, SEEK_END) < 0) {
-        LOG_ERRNO("%s: failed to seek to end of file", path);
-        return NULL;
-    }
-    image_size = ftell(fp);
-    if (fseek(fp, 0, SEEK_SET) < 0) {
-        LOG_ERRNO("%s: failed to seek to beginning of file", path);
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        LOG_ERR("%s: libwebp version mismatch", path);
         return NULL;
     }
 
-    if (!(file_data = WebPMalloc(image_size + 1))) {
+    if ((file_data = image_map_file(fp, path, &file_size)) == NULL)
         goto out;
-    }
-
-    clearerr(fp);
-    if (fread(file_data, image_size, 1, fp) != image_size && ferror(fp)) {
-        LOG_ERRNO("%s: failed to read", path);
-        goto out;
-    }
-    file_data[image_size] = '\0';
 
     /* Verify it is a webp image */
-    if (!WebPGetInfo(file_data, image_size, NULL, NULL)) {
+    if (WebPGetFeatures(file_data, file_size, &config.input) != VP8_STATUS_OK) {
         LOG_DBG("%s: not a WebP file", path);
         goto out;
     }
 
-    image_data = WebPDecodeRGBA(file_data, image_size, &width, &height);
-    if (image_data == NULL) {
-        goto out;
+    const int image_width = config.input.width;
+    const int image_height = config.input.height;
+    const double s = image_target_scale(target, image_width, image_height);
+
+    width = image_width;
+    height = image_height;
+
+    /*
+     * When stretched to a single output size, only the center of the
+     * image is visible. Crop away the rest. libwebp snaps the top
+     * left corner to even coordinates; compensate by growing the
+     * crop region.
+     */
+    if (target->stretch && target->uniform) {
+        int crop_width = ceil(target->width / s);
+        int crop_height = ceil(target->height / s);
+
+        if (crop_width < image_width || crop_height < image_height) {
+            int x = ((image_width - crop_width) / 2) & ~1;
+            int y = ((image_height - crop_height) / 2) & ~1;
+
+            crop_width = image_width - 2 * x;
+            crop_height = image_height - 2 * y;
+
+            config.options.use_cropping = 1;
+            config.options.crop_left = x;
+            config.options.crop_top = y;
+            config.options.crop_width = crop_width;
+            config.options.crop_height = crop_height;
+
+            width = crop_width;
+            height = crop_height;
+        }
     }
-    format = PIXMAN_x8b8g8r8;
+
+    if (s < 1.) {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = width = ceil(width * s);
+        config.options.scaled_height = height = ceil(height * s);
+    }
+
+    *reduced = width < image_width || height < image_height;
+
+    LOG_DBG("%s: %dx%d, decoding %s%s to %dx%d", path, image_width, image_height,
+            config.options.use_cropping ? "cropped, " : "",
+            config.options.use_scaling ? "scaled" : "unscaled", width, height);
+
+    format = config.input.has_alpha ? PIXMAN_a8r8g8b8 : PIXMAN_x8r8g8b8;
     stride = stride_for_format_and_width(format, width);
 
-    for (uint32_t *abgr = (uint32_t *)image_data;
-         abgr < (uint32_t *)(image_data + (size_t)width * (size_t)height * 4);
-         abgr++) {
-        uint8_t alpha = (*abgr >> 24) & 0xff;
-        uint8_t red   = (*abgr >> 16) & 0xff;
-        uint8_t green = (*abgr >> 8) & 0xff;
-        uint8_t blue  = (*abgr >> 0) & 0xff;
-
-        if (alpha == 0xff)
-            continue;
-
-        if (alpha == 0x00)
-            blue = green = red = 0x00;
-        else {
-            blue = blue * alpha / 0xff;
-            green = green * alpha / 0xff;
-            red = red * alpha / 0xff;
-        }
+    if ((image_data = malloc((size_t)height * stride)) == NULL)
+        goto out;
 
-        *abgr = (uint32_t)alpha << 24 | red << 16 | green << 8 | blue;
+    /*
+     * Pre-multiplied BGRA in memory is pre-multiplied ARGB in a
+     * (little endian) 32-bit word; decode straight into our buffer.
+     */
+    config.options.use_threads = 1;
+    config.output.colorspace = MODE_bgrA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = image_data;
+    config.output.u.RGBA.stride = stride;
+    config.output.u.RGBA.size = (size_t)height * stride;
+
+    VP8StatusCode status = WebPDecode(file_data, file_size, &config);
+    if (status != VP8_STATUS_OK) {
+        LOG_ERR("%s: failed to decode (status=%d)", path, status);
+        goto out;
     }
 
-
     ok = NULL != (pix = pixman_image_create_bits_no_clear(
         format, width, height, (uint32_t *)image_data, stride));
 
@@ -86,9 +116,10 @@ webp_load(FILE *fp, const char *path)
     }
 
 out:
-    WebPFree(file_data);
+    WebPFreeDecBuffer(&config.output);
+    image_unmap_file(file_data, file_size);
     if (!ok)
-        WebPFree(image_data);
+        free(image_data);
 
     return pix;
 }
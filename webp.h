@@ -3,4 +3,7 @@
 #include <stdio.h>
 #include <pixman.h>
 
-pixman_image_t *webp_load(FILE *fp, const char *path);
+#include "image.h"
+
+pixman_image_t *webp_load(FILE *fp, const char *path,
+                          const struct image_target *target, bool *reduced);